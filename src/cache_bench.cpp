@@ -0,0 +1,756 @@
+// Cache microbenchmarks.
+//
+// 1. Layout: node-based LRU (list + unordered_map, the original cache layout)
+//    vs FlatCacheIndex. Reports heap bytes per entry and ns per operation for
+//    lookup hits, a 90/10 get/put mix, and insert+evict churn.
+// 2. Policies: replays one synthetic trace (Zipf-distributed keys with
+//    periodic one-pass scans) against ShardedCache with every eviction policy
+//    and reports hit ratio, ns per request and the database time the misses
+//    would cost (every 8th key is 20x as expensive to fetch).
+// 3. Read scaling: threads reading a small hot key set (the /kv_popular
+//    pattern) through ShardedCache with each locking policy; reports
+//    million hits per second by thread count.
+// 4. Lost updates: threads write, delete and fill misses for a few keys
+//    against a mutex-per-row stand-in for MySQL, following the server's
+//    protocol with and without write versions, then count keys whose cached
+//    value differs from the "database". Must be 0 with versions, also when
+//    all keys share one version stripe.
+// 5. Connection pool: threads acquire and release pooled objects through the
+//    server's old pool (mutex, linear scans of an in_use vector) and through
+//    SlotQueue; reports million acquire/release pairs per second.
+//
+// Build: g++ -O2 -std=c++17 -pthread src/cache_bench.cpp -o cache_bench
+// Usage: ./cache_bench [entries] [ops]
+
+#include "flat_cache_index.h"
+#include "sharded_cache.h"
+#include "slot_queue.h"
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <cmath>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+using namespace std;
+
+// -------------------- Heap accounting --------------------
+// Every allocation carries a small header with its size so live bytes can be
+// tracked precisely across both layouts.
+static std::atomic<long long> live_bytes{0};
+static std::atomic<long long> heap_allocs{0};
+// Off for the multi-threaded section, where the shared counters would be
+// the bottleneck being measured
+static bool heap_accounting = true;
+
+void *operator new(size_t n)
+{
+    size_t *p = static_cast<size_t *>(malloc(n + sizeof(size_t) * 2));
+    if (!p)
+        throw std::bad_alloc();
+    p[0] = n;
+    if (heap_accounting)
+    {
+        live_bytes += n;
+        heap_allocs++;
+    }
+    return p + 2;
+}
+
+// Slab pages are allocated aligned to their size; the size header sits just
+// below the returned block
+void *operator new(size_t n, std::align_val_t al)
+{
+    size_t align = static_cast<size_t>(al);
+    char *base = static_cast<char *>(aligned_alloc(align, n + align));
+    if (!base)
+        throw std::bad_alloc();
+    reinterpret_cast<size_t *>(base + align)[-1] = n;
+    if (heap_accounting)
+    {
+        live_bytes += n;
+        heap_allocs++;
+    }
+    return base + align;
+}
+
+void operator delete(void *ptr, std::align_val_t al) noexcept
+{
+    if (!ptr)
+        return;
+    size_t align = static_cast<size_t>(al);
+    if (heap_accounting)
+        live_bytes -= static_cast<size_t *>(ptr)[-1];
+    free(static_cast<char *>(ptr) - align);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (!ptr)
+        return;
+    size_t *p = static_cast<size_t *>(ptr) - 2;
+    if (heap_accounting)
+        live_bytes -= p[0];
+    free(p);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+// -------------------- Layouts under test --------------------
+class NodeLru
+{
+    list<pair<string, string>> lru_list; // front = oldest, back = newest
+    unordered_map<string, list<pair<string, string>>::iterator> cache_map;
+    size_t capacity;
+
+public:
+    explicit NodeLru(size_t cap) : capacity(cap) {}
+
+    bool get(const string &key, string &out)
+    {
+        auto it = cache_map.find(key);
+        if (it == cache_map.end())
+            return false;
+        out = it->second->second;
+        lru_list.splice(lru_list.end(), lru_list, it->second);
+        return true;
+    }
+
+    void put(const string &key, const string &value)
+    {
+        auto it = cache_map.find(key);
+        if (it != cache_map.end())
+        {
+            it->second->second = value;
+            lru_list.splice(lru_list.end(), lru_list, it->second);
+            return;
+        }
+        if (cache_map.size() >= capacity)
+        {
+            cache_map.erase(lru_list.front().first);
+            lru_list.pop_front();
+        }
+        lru_list.push_back({key, value});
+        cache_map[key] = --lru_list.end();
+    }
+};
+
+class FlatLru
+{
+    FlatCacheIndex index;
+    LruPolicy policy;
+
+public:
+    explicit FlatLru(size_t cap) : index(static_cast<uint32_t>(cap)), policy(index, cap) {}
+
+    bool get(const string &key, string &out)
+    {
+        uint32_t idx = index.find(key, std::hash<string>{}(key));
+        if (idx == FlatCacheIndex::npos)
+            return false;
+        out.assign(index.at(idx).value());
+        policy.on_hit(idx);
+        return true;
+    }
+
+    void put(const string &key, const string &value)
+    {
+        size_t hash = std::hash<string>{}(key);
+        uint32_t idx = index.find(key, hash);
+        if (idx != FlatCacheIndex::npos)
+        {
+            index.assign(idx, value);
+            policy.on_hit(idx);
+            return;
+        }
+        if (index.full())
+        {
+            uint32_t victim = policy.victim();
+            policy.on_evict(victim);
+            index.erase(victim);
+        }
+        policy.on_insert(index.insert(key, value, hash));
+    }
+};
+
+// -------------------- Driver --------------------
+struct Result
+{
+    double bytes_per_entry;
+    double hit_ns;
+    double mix_ns;
+    double churn_ns;
+    double churn_allocs; // heap allocations per churn operation
+};
+
+template <typename Cache>
+Result run(size_t entries, size_t ops, const vector<string> &keys, const string &value)
+{
+    Result r{};
+    mt19937_64 gen(42);
+    string out;
+
+    long long before = live_bytes.load();
+    Cache cache(entries);
+    for (size_t i = 0; i < entries; ++i)
+        cache.put(keys[i], value);
+    r.bytes_per_entry = double(live_bytes.load() - before) / entries;
+
+    auto time_ns = [&](auto &&body)
+    {
+        auto t0 = chrono::steady_clock::now();
+        body();
+        auto t1 = chrono::steady_clock::now();
+        return double(chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count()) / ops;
+    };
+
+    // All lookups hit
+    uniform_int_distribution<size_t> resident(0, entries - 1);
+    r.hit_ns = time_ns([&]
+                       {
+        for (size_t i = 0; i < ops; ++i)
+            cache.get(keys[resident(gen)], out); });
+
+    // 90% reads / 10% overwrites of resident keys
+    r.mix_ns = time_ns([&]
+                       {
+        for (size_t i = 0; i < ops; ++i)
+        {
+            const string &k = keys[resident(gen)];
+            if (i % 10 == 0)
+                cache.put(k, value);
+            else
+                cache.get(k, out);
+        } });
+
+    // Key universe twice the capacity: about half the operations miss and
+    // insert with an eviction
+    uniform_int_distribution<size_t> universe(0, keys.size() - 1);
+    long long allocs_before = heap_allocs.load();
+    r.churn_ns = time_ns([&]
+                         {
+        for (size_t i = 0; i < ops; ++i)
+        {
+            const string &k = keys[universe(gen)];
+            if (!cache.get(k, out))
+                cache.put(k, value);
+        } });
+    r.churn_allocs = double(heap_allocs.load() - allocs_before) / ops;
+
+    return r;
+}
+
+// -------------------- Policy comparison --------------------
+// Zipf(0.99) over a universe 10x the cache size; every 10th block of
+// `entries` requests is replaced by a sequential scan of cold keys.
+vector<size_t> make_trace(size_t entries, size_t ops)
+{
+    size_t universe = entries * 10;
+    vector<double> cdf(universe);
+    double sum = 0;
+    for (size_t i = 0; i < universe; ++i)
+    {
+        sum += 1.0 / pow(double(i + 1), 0.99);
+        cdf[i] = sum;
+    }
+
+    mt19937_64 gen(7);
+    uniform_real_distribution<double> u(0, sum);
+    vector<size_t> trace;
+    trace.reserve(ops);
+    size_t scan_next = universe;
+    for (size_t i = 0; i < ops; ++i)
+    {
+        if ((i / entries) % 10 == 9)
+            trace.push_back(scan_next++);
+        else
+            trace.push_back(lower_bound(cdf.begin(), cdf.end(), u(gen)) - cdf.begin());
+    }
+    return trace;
+}
+
+// Synthetic fetch cost of key k: most rows take 100us, every 8th 2ms
+uint32_t fetch_cost_us(size_t k) { return k % 8 == 0 ? 2000 : 100; }
+
+template <typename Eviction>
+void replay(size_t entries, const vector<size_t> &trace, const vector<string> &names, const string &value)
+{
+    CacheConfig config;
+    config.max_items = entries;
+    config.shards = 1;
+    ShardedCache<Eviction, MutexLocking> cache(config);
+
+    SharedValue out;
+    long long hits = 0;
+    double miss_cost_us = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (size_t k : trace)
+    {
+        const string &key = names[k];
+        if (cache.get(key, out))
+        {
+            hits++;
+            continue;
+        }
+        miss_cost_us += fetch_cost_us(k);
+        cache.put(key, value, false, 0, 0, 0, fetch_cost_us(k));
+    }
+    auto t1 = chrono::steady_clock::now();
+
+    double ns = double(chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count()) / trace.size();
+    cout << left << setw(22) << Eviction::kName << right << fixed << setprecision(4) << setw(14)
+         << double(hits) / trace.size() << setprecision(1) << setw(12) << ns << setw(14) << miss_cost_us / 1e6
+         << endl;
+}
+
+// Million hits/s for threads reading hot keys, ops lookups in total
+template <typename Locking>
+double read_scaling(size_t threads, size_t ops, const vector<string> &hot, const string &value)
+{
+    CacheConfig config;
+    config.max_items = hot.size() * 2;
+    config.shards = 16;
+    ShardedCache<LruPolicy, Locking> cache(config);
+    for (const string &key : hot)
+        cache.put(key, value);
+
+    atomic<bool> go{false};
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]
+                             {
+            while (!go.load(memory_order_acquire))
+                ;
+            SharedValue out;
+            size_t n = ops / threads;
+            for (size_t i = 0; i < n; ++i)
+                cache.get(hot[(i * 7 + t * 131) % hot.size()], out); });
+    auto t0 = chrono::steady_clock::now();
+    go.store(true, memory_order_release);
+    for (thread &w : workers)
+        w.join();
+    auto t1 = chrono::steady_clock::now();
+    return double(ops) / chrono::duration_cast<chrono::microseconds>(t1 - t0).count();
+}
+
+// One row of the stand-in database; its mutex orders writes like InnoDB's row lock
+struct StressRow
+{
+    mutex m;
+    bool present = false;
+    string value;
+    uint64_t version = 0;
+};
+
+// Keys whose cached value is not the database's after a racing workload.
+// versioned = the server's protocol (versions in row and cache, conditional
+// delete, fill_miss); otherwise writes and fills go to the cache unconditionally.
+// same_stripe = all keys share one shard and version stripe, so each key's
+// writes race against the others' floors.
+size_t lost_updates(bool versioned, size_t threads, size_t ops, bool same_stripe = false)
+{
+    using StressCache = ShardedCache<LruPolicy, MutexLocking>;
+    const size_t num_keys = 16;
+    CacheConfig config;
+    config.max_items = num_keys * 4;
+    config.shards = 2;
+    StressCache cache(config);
+    vector<StressRow> db(num_keys);
+    vector<string> names;
+    size_t first_hash = 0;
+    for (size_t i = 0; names.size() < num_keys; ++i)
+    {
+        string name = "key_" + to_string(i);
+        size_t h = hash<string>{}(name);
+        if (names.empty())
+            first_hash = h;
+        // Same shard (hash >> 32 picks it) and same stripe as the first key
+        else if (same_stripe && (((h >> 32) ^ (first_hash >> 32)) % config.shards != 0 ||
+                                 h % StressCache::kVersionStripes != first_hash % StressCache::kVersionStripes))
+            continue;
+        names.push_back(name);
+    }
+    atomic<uint64_t> clock{0};
+
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]
+                             {
+            mt19937_64 gen(t + 1);
+            // Widens the window between the database and the cache
+            auto pause = [&]
+            { this_thread::sleep_for(chrono::microseconds(gen() % 20)); };
+            SharedValue out;
+            for (size_t i = 0; i < ops / threads; ++i)
+            {
+                size_t k = gen() % num_keys;
+                const string &key = names[k];
+                StressRow &row = db[k];
+                int op = gen() % 10;
+                if (op < 4) // POST
+                {
+                    uint64_t v = ++clock;
+                    string value = to_string(t) + ":" + to_string(v);
+                    {
+                        lock_guard<mutex> lk(row.m);
+                        if (!versioned || !row.present || row.version < v)
+                        {
+                            row.present = true;
+                            row.value = value;
+                            row.version = v;
+                        }
+                    }
+                    pause();
+                    cache.put(key, value, true, 0, 0, versioned ? v : 0);
+                }
+                else if (op < 5) // DELETE
+                {
+                    uint64_t v = ++clock;
+                    {
+                        lock_guard<mutex> lk(row.m);
+                        if (!versioned || row.version < v)
+                            row.present = false;
+                    }
+                    pause();
+                    cache.erase(key, versioned ? v : 0);
+                }
+                else if (!cache.get(key, out)) // GET miss
+                {
+                    uint64_t floor = cache.version_floor(key);
+                    bool present;
+                    string value;
+                    uint64_t version;
+                    {
+                        lock_guard<mutex> lk(row.m);
+                        present = row.present;
+                        value = row.value;
+                        version = row.version;
+                    }
+                    pause();
+                    if (!present)
+                        continue;
+                    if (versioned)
+                        cache.fill_miss(key, make_shared<const string>(value), version, floor);
+                    else
+                        cache.put(key, value, false);
+                }
+            } });
+    for (thread &w : workers)
+        w.join();
+
+    size_t stale = 0;
+    SharedValue out;
+    for (size_t k = 0; k < num_keys; ++k)
+        if (cache.get(names[k], out) && (!db[k].present || *out != db[k].value))
+            stale++;
+    return stale;
+}
+
+// Keys whose row in the stand-in database disagrees with the newest POST or
+// DELETE sent for them, after POSTs and DELETEs reach it out of order.
+// tombstones = a DELETE leaves its version behind (the server's tombstone
+// row); otherwise the row goes away with its version and an older POST that
+// arrives later inserts it again.
+size_t lost_deletes(bool tombstones, size_t threads, size_t ops)
+{
+    const size_t num_keys = 16;
+    vector<StressRow> db(num_keys);
+    vector<StressRow> newest(num_keys); // the op with the highest version per key
+    atomic<uint64_t> clock{0};
+
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]
+                             {
+            mt19937_64 gen(t + 1);
+            for (size_t i = 0; i < ops / threads; ++i)
+            {
+                size_t k = gen() % num_keys;
+                bool post = gen() % 2 == 0;
+                uint64_t v = ++clock;
+                string value = to_string(t) + ":" + to_string(v);
+                {
+                    lock_guard<mutex> lk(newest[k].m);
+                    if (newest[k].version < v)
+                    {
+                        newest[k].present = post;
+                        newest[k].value = value;
+                        newest[k].version = v;
+                    }
+                }
+                // The request's way to MySQL
+                this_thread::sleep_for(chrono::microseconds(gen() % 20));
+                StressRow &row = db[k];
+                lock_guard<mutex> lk(row.m);
+                if (row.version >= v)
+                    continue;
+                row.present = post;
+                row.value = value;
+                row.version = post || tombstones ? v : 0;
+            } });
+    for (thread &w : workers)
+        w.join();
+
+    size_t lost = 0;
+    for (size_t k = 0; k < num_keys; ++k)
+        if (db[k].present != newest[k].present || (db[k].present && db[k].value != newest[k].value))
+            lost++;
+    return lost;
+}
+
+// Refresh-ahead re-reads a key whose row is then overwritten: each round
+// puts version 1, takes the floor as refresh_loop does before its SELECT,
+// puts version 2 (usually in the same millisecond, so stored_at cannot tell
+// them apart) and hands refresh() the version 1 row. Returns the rounds that
+// left version 1 cached.
+size_t stale_refreshes(size_t rounds)
+{
+    CacheConfig config;
+    config.max_items = 64;
+    ShardedCache<LruPolicy, MutexLocking> cache(config);
+    size_t stale = 0;
+    SharedValue out;
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        string key = "key_" + to_string(r % 16);
+        uint64_t v1 = 2 * r + 1, v2 = 2 * r + 2;
+        cache.put(key, "v1", true, 0, 0, v1);
+        EntryInfo info;
+        cache.get(key, out, &info);
+        uint64_t floor = cache.version_floor(key);
+        cache.put(key, "v2", true, 0, 0, v2);
+        cache.refresh(key, info.stored_at, floor, make_shared<const string>("v1"), 0, 0, v1);
+        if (!cache.get(key, out) || *out != "v2")
+            stale++;
+    }
+    return stale;
+}
+
+// -------------------- Connection pool --------------------
+// Stand-in for a pooled connection
+struct FakeConnection
+{
+    long long uses = 0;
+};
+
+// The server's original ConnectionPool without its per-acquire isValid()
+// round trip: one mutex, a linear scan for a free slot in acquire and for the
+// pointer in release
+class ScanPool
+{
+public:
+    explicit ScanPool(size_t n) : conns_(n), in_use_(n, false) {}
+
+    FakeConnection *acquire()
+    {
+        unique_lock<mutex> lk(mutex_);
+        cv_.wait(lk, [&]()
+                 {
+            for (size_t i = 0; i < conns_.size(); ++i)
+                if (!in_use_[i])
+                    return true;
+            return false; });
+        for (size_t i = 0; i < conns_.size(); ++i)
+            if (!in_use_[i])
+            {
+                in_use_[i] = true;
+                return &conns_[i];
+            }
+        return nullptr;
+    }
+
+    void release(FakeConnection *c)
+    {
+        unique_lock<mutex> lk(mutex_);
+        for (size_t i = 0; i < conns_.size(); ++i)
+            if (&conns_[i] == c)
+            {
+                in_use_[i] = false;
+                cv_.notify_one();
+                return;
+            }
+    }
+
+private:
+    vector<FakeConnection> conns_;
+    vector<bool> in_use_;
+    mutex mutex_;
+    condition_variable cv_;
+};
+
+// The server's pool: SlotQueue of free slots, fixed pointer -> slot map
+class QueuePool
+{
+public:
+    explicit QueuePool(size_t n) : conns_(n), idle_(n)
+    {
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            slot_of_[&conns_[i]] = i;
+            idle_.push(i);
+        }
+    }
+
+    FakeConnection *acquire() { return &conns_[idle_.pop()]; }
+    void release(FakeConnection *c) { idle_.push(slot_of_.find(c)->second); }
+
+private:
+    vector<FakeConnection> conns_;
+    unordered_map<FakeConnection *, uint32_t> slot_of_;
+    SlotQueue idle_;
+};
+
+// Million acquire/release pairs per second, ops pairs in total
+template <typename Pool>
+double pool_throughput(size_t threads, size_t ops, size_t pool_size)
+{
+    Pool pool(pool_size);
+    atomic<bool> go{false};
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+        workers.emplace_back([&]
+                             {
+            while (!go.load(memory_order_acquire))
+                ;
+            size_t n = ops / threads;
+            for (size_t i = 0; i < n; ++i)
+            {
+                FakeConnection *c = pool.acquire();
+                c->uses++;
+                pool.release(c);
+            } });
+    auto t0 = chrono::steady_clock::now();
+    go.store(true, memory_order_release);
+    for (thread &w : workers)
+        w.join();
+    auto t1 = chrono::steady_clock::now();
+    return double(ops) / chrono::duration_cast<chrono::microseconds>(t1 - t0).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t entries = argc > 1 ? stoul(argv[1]) : 100000;
+    size_t ops = argc > 2 ? stoul(argv[2]) : 2000000;
+    if (entries == 0 || ops == 0)
+    {
+        cerr << "Usage: ./cache_bench [entries] [ops]" << endl;
+        return 1;
+    }
+
+    // Same key shape as the load generator; value fits in one cache line
+    vector<string> keys;
+    keys.reserve(entries * 2);
+    for (size_t i = 0; i < entries * 2; ++i)
+        keys.push_back("key_" + to_string(i));
+    string value(64, 'v');
+
+    Result node = run<NodeLru>(entries, ops, keys, value);
+    Result flat = run<FlatLru>(entries, ops, keys, value);
+
+    cout << "entries=" << entries << " ops=" << ops << " value_bytes=" << value.size() << endl;
+    cout << left << setw(22) << "layout" << right << setw(14) << "bytes/entry" << setw(12) << "hit ns" << setw(12)
+         << "mix ns" << setw(12) << "churn ns" << setw(14) << "allocs/op" << endl;
+    auto row = [](const string &name, const Result &r)
+    {
+        cout << left << setw(22) << name << right << fixed << setprecision(1) << setw(14) << r.bytes_per_entry
+             << setw(12) << r.hit_ns << setw(12) << r.mix_ns << setw(12) << r.churn_ns << setprecision(3) << setw(14)
+             << r.churn_allocs << endl;
+    };
+    row("list+unordered_map", node);
+    row("FlatCacheIndex", flat);
+
+    vector<size_t> trace = make_trace(entries, ops);
+    size_t max_key = *max_element(trace.begin(), trace.end());
+    vector<string> names;
+    names.reserve(max_key + 1);
+    for (size_t i = 0; i <= max_key; ++i)
+        names.push_back("key_" + to_string(i));
+
+    cout << endl
+         << "policy comparison: zipf 0.99 over " << entries * 10 << " keys + scans, capacity " << entries << endl;
+    cout << left << setw(22) << "policy" << right << setw(14) << "hit ratio" << setw(12) << "ns/req" << setw(14)
+         << "miss cost s" << endl;
+    replay<LruPolicy>(entries, trace, names, value);
+    replay<ClockPolicy>(entries, trace, names, value);
+    replay<TwoQueuePolicy>(entries, trace, names, value);
+    replay<ArcPolicy>(entries, trace, names, value);
+    replay<S3FifoPolicy>(entries, trace, names, value);
+    replay<GdsfPolicy>(entries, trace, names, value);
+
+    heap_accounting = false;
+    vector<string> hot(keys.begin(), keys.begin() + min<size_t>(keys.size(), 1024));
+    size_t max_threads = max(1u, thread::hardware_concurrency());
+    cout << endl
+         << "read scaling: " << hot.size() << " hot keys, 16 shards, M hits/s" << endl;
+    cout << left << setw(22) << "threads" << right << setw(14) << "mutex" << setw(12) << "rwlock" << setw(12) << "rcu"
+         << endl;
+    for (size_t threads = 1;; threads = min(threads * 2, max_threads))
+    {
+        cout << left << setw(22) << threads << right << fixed << setprecision(1) << setw(14)
+             << read_scaling<MutexLocking>(threads, ops, hot, value) << setw(12)
+             << read_scaling<RwLocking>(threads, ops, hot, value) << setw(12)
+             << read_scaling<RcuLocking>(threads, ops, hot, value) << endl;
+        if (threads == max_threads)
+            break;
+    }
+
+    size_t stress_threads = max<size_t>(8, max_threads);
+    size_t rounds = 20;
+    size_t stale_plain = 0, stale_versioned = 0, stale_striped = 0;
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        stale_plain += lost_updates(false, stress_threads, ops / 100);
+        stale_versioned += lost_updates(true, stress_threads, ops / 100);
+        stale_striped += lost_updates(true, stress_threads, ops / 100, true);
+    }
+    cout << endl
+         << "lost updates: " << rounds << " rounds of " << ops / 100 << " writes/deletes/misses on 16 keys, "
+         << stress_threads << " threads" << endl;
+    cout << left << setw(22) << "protocol" << right << setw(14) << "stale keys" << endl;
+    cout << left << setw(22) << "unversioned" << right << setw(14) << stale_plain << endl;
+    cout << left << setw(22) << "versioned" << right << setw(14) << stale_versioned << endl;
+    cout << left << setw(22) << "versioned, 1 stripe" << right << setw(14) << stale_striped << endl;
+    size_t stale_refreshed = stale_refreshes(ops / 100);
+    cout << left << setw(22) << "refresh after a put" << right << setw(14) << stale_refreshed << endl;
+    size_t lost_plain = 0, lost_tombstoned = 0;
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        lost_plain += lost_deletes(false, stress_threads, ops / 100);
+        lost_tombstoned += lost_deletes(true, stress_threads, ops / 100);
+    }
+    cout << endl
+         << "lost deletes: " << rounds << " rounds of " << ops / 100 << " out-of-order POSTs/DELETEs on 16 keys, "
+         << stress_threads << " threads" << endl;
+    cout << left << setw(22) << "delete" << right << setw(14) << "wrong rows" << endl;
+    cout << left << setw(22) << "row DELETE" << right << setw(14) << lost_plain << endl;
+    cout << left << setw(22) << "tombstone" << right << setw(14) << lost_tombstoned << endl;
+
+    // More threads than connections, as with the server's worker threads
+    const size_t pool_size = 10;
+    size_t max_pool_threads = max<size_t>(4 * pool_size, max_threads);
+    cout << endl
+         << "connection pool: " << pool_size << " connections, M acquire+release/s" << endl;
+    cout << left << setw(22) << "threads" << right << setw(14) << "mutex+scan" << setw(12) << "slot queue" << endl;
+    for (size_t threads = 1;; threads = min(threads * 2, max_pool_threads))
+    {
+        cout << left << setw(22) << threads << right << fixed << setprecision(2) << setw(14)
+             << pool_throughput<ScanPool>(threads, ops, pool_size) << setw(12)
+             << pool_throughput<QueuePool>(threads, ops, pool_size) << endl;
+        if (threads == max_pool_threads)
+            break;
+    }
+    return stale_versioned == 0 && stale_striped == 0 && stale_refreshed == 0 && lost_tombstoned == 0 ? 0 : 1;
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// -------------------- Cache snapshot file --------------------
+// Binary image of the cache written on shutdown and on a schedule, and mapped
+// read-only on startup so cached values are available before anything has
+// been rebuilt.
+//
+// Layout (native byte order; a file from another architecture fails
+// validation):
+//   SnapshotHeader
+//   records in eviction order, first to be evicted first. Each record is a
+//     SnapshotRecordHeader followed by the key and value bytes, padded to 8
+//   hash table of table_slots uint64 slots: 0 = empty, otherwise 1 + the
+//     file offset of a record. Linear probing on snapshot_hash(key).
+//
+// The header checksum covers the header and the hash table and is checked
+// when the file is opened. Each record carries its own checksum, checked
+// when the record is read, so opening a multi-GB snapshot does not read all
+// of it and a damaged record is skipped without discarding the rest.
+
+constexpr char kSnapshotMagic[8] = {'K', 'V', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr uint32_t kSnapshotVersion = 2;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags; // kSnapshotClean if written after the server stopped taking writes
+    int64_t created_ms;
+    uint64_t record_count;
+    uint64_t records_offset;
+    uint64_t table_offset;
+    uint64_t table_slots;
+    uint64_t file_bytes;
+    uint64_t checksum;
+};
+
+constexpr uint32_t kSnapshotClean = 1;
+
+struct SnapshotRecordHeader
+{
+    uint32_t key_size;
+    uint32_t value_size;
+    int64_t expires_at;
+    uint32_t flags; // the cache entry's flags (value encoding)
+    uint32_t reserved;
+    uint64_t checksum;
+};
+
+struct SnapshotRecord
+{
+    std::string_view key;
+    std::string_view value;
+    int64_t expires_at = 0;
+    uint32_t flags = 0;
+};
+
+// 64-bit hash, eight bytes per step; used for keys and checksums
+inline uint64_t snapshot_hash(const void *data, size_t len, uint64_t h = 0xcbf29ce484222325ULL)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const uint64_t prime = 0x100000001b3ULL;
+    while (len >= 8)
+    {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        h = (h ^ w) * prime;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
+    while (len > 0)
+    {
+        h = (h ^ *p++) * prime;
+        --len;
+    }
+    h ^= h >> 32;
+    return h * 0x9E3779B97F4A7C15ULL;
+}
+
+inline uint64_t snapshot_record_checksum(std::string_view key, std::string_view value, int64_t expires_at,
+                                         uint32_t flags)
+{
+    uint64_t h = snapshot_hash(&expires_at, sizeof(expires_at));
+    h = snapshot_hash(&flags, sizeof(flags), h);
+    h = snapshot_hash(key.data(), key.size(), h);
+    return snapshot_hash(value.data(), value.size(), h);
+}
+
+// Writes a snapshot to path + ".tmp" and renames it over path on commit(),
+// so readers only ever see complete files.
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(const std::string &path) : path_(path), tmp_path_(path + ".tmp")
+    {
+        file_ = std::fopen(tmp_path_.c_str(), "wb");
+        SnapshotHeader blank{};
+        if (file_ && std::fwrite(&blank, sizeof(blank), 1, file_) != 1)
+            fail();
+        offset_ = sizeof(SnapshotHeader);
+    }
+
+    ~SnapshotWriter()
+    {
+        if (file_)
+        {
+            std::fclose(file_);
+            std::remove(tmp_path_.c_str());
+        }
+    }
+
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    bool ok() const { return file_ != nullptr; }
+    uint64_t records() const { return entries_.size(); }
+    uint64_t bytes() const { return offset_; }
+
+    void add(std::string_view key, std::string_view value, int64_t expires_at, uint32_t flags = 0)
+    {
+        if (!file_)
+            return;
+        SnapshotRecordHeader rh{static_cast<uint32_t>(key.size()), static_cast<uint32_t>(value.size()), expires_at,
+                                flags, 0, snapshot_record_checksum(key, value, expires_at, flags)};
+        static const char zeros[8] = {};
+        size_t body = key.size() + value.size();
+        size_t pad = (8 - body % 8) % 8;
+        if (std::fwrite(&rh, sizeof(rh), 1, file_) != 1 || std::fwrite(key.data(), 1, key.size(), file_) != key.size() ||
+            std::fwrite(value.data(), 1, value.size(), file_) != value.size() ||
+            std::fwrite(zeros, 1, pad, file_) != pad)
+        {
+            fail();
+            return;
+        }
+        entries_.push_back({snapshot_hash(key.data(), key.size()), offset_});
+        offset_ += sizeof(rh) + body + pad;
+    }
+
+    // Write the table and header, flush to disk and move the file into place
+    bool commit(int64_t created_ms, bool clean)
+    {
+        if (!file_)
+            return false;
+
+        uint64_t slots = 16;
+        while (slots < 2 * entries_.size())
+            slots <<= 1;
+        std::vector<uint64_t> table(slots, 0);
+        for (const auto &entry : entries_)
+        {
+            uint64_t i = entry.first & (slots - 1);
+            while (table[i] != 0)
+                i = (i + 1) & (slots - 1);
+            table[i] = entry.second + 1;
+        }
+
+        SnapshotHeader h{};
+        std::memcpy(h.magic, kSnapshotMagic, sizeof(h.magic));
+        h.version = kSnapshotVersion;
+        h.flags = clean ? kSnapshotClean : 0;
+        h.created_ms = created_ms;
+        h.record_count = entries_.size();
+        h.records_offset = sizeof(SnapshotHeader);
+        h.table_offset = offset_;
+        h.table_slots = slots;
+        h.file_bytes = offset_ + slots * sizeof(uint64_t);
+        h.checksum = header_checksum(h, table.data());
+
+        bool ok = std::fwrite(table.data(), sizeof(uint64_t), slots, file_) == slots &&
+                  std::fseek(file_, 0, SEEK_SET) == 0 && std::fwrite(&h, sizeof(h), 1, file_) == 1 &&
+                  std::fflush(file_) == 0 && ::fsync(fileno(file_)) == 0;
+        ok = std::fclose(file_) == 0 && ok;
+        file_ = nullptr;
+        if (ok && std::rename(tmp_path_.c_str(), path_.c_str()) == 0)
+            return true;
+        std::remove(tmp_path_.c_str());
+        return false;
+    }
+
+    // Checksum of a header (with its checksum field zeroed) and its table
+    static uint64_t header_checksum(SnapshotHeader h, const uint64_t *table)
+    {
+        h.checksum = 0;
+        uint64_t sum = snapshot_hash(&h, sizeof(h));
+        return snapshot_hash(table, h.table_slots * sizeof(uint64_t), sum);
+    }
+
+private:
+    void fail()
+    {
+        std::fclose(file_);
+        std::remove(tmp_path_.c_str());
+        file_ = nullptr;
+    }
+
+    std::string path_;
+    std::string tmp_path_;
+    std::FILE *file_ = nullptr;
+    uint64_t offset_ = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> entries_; // (key hash, record offset)
+};
+
+// Read-only view of a snapshot file through mmap. Thread-safe: nothing is
+// written after open().
+class SnapshotReader
+{
+public:
+    // Map and validate path. Returns nullptr and sets error if the file is
+    // missing, older than max_age_ms (0 = any age), from another version or
+    // damaged.
+    static std::unique_ptr<SnapshotReader> open(const std::string &path, int64_t now_ms, int64_t max_age_ms,
+                                                std::string &error)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            error = "no snapshot";
+            return nullptr;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader))
+        {
+            ::close(fd);
+            error = "truncated file";
+            return nullptr;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void *base = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED)
+        {
+            error = "mmap failed";
+            return nullptr;
+        }
+
+        std::unique_ptr<SnapshotReader> reader(new SnapshotReader(static_cast<const char *>(base), size));
+        const SnapshotHeader &h = reader->header_;
+        if (std::memcmp(h.magic, kSnapshotMagic, sizeof(h.magic)) != 0)
+            error = "not a snapshot";
+        else if (h.version != kSnapshotVersion)
+            error = "version " + std::to_string(h.version) + ", expected " + std::to_string(kSnapshotVersion);
+        else if (h.file_bytes != size || h.table_offset > size || h.records_offset > h.table_offset ||
+                 h.table_slots == 0 || (h.table_slots & (h.table_slots - 1)) != 0 ||
+                 h.table_slots > (size - h.table_offset) / sizeof(uint64_t))
+            error = "inconsistent header";
+        else if (SnapshotWriter::header_checksum(h, reader->table()) != h.checksum)
+            error = "checksum mismatch";
+        else if (max_age_ms > 0 && now_ms - h.created_ms > max_age_ms)
+            error = "older than the maximum age";
+        if (!error.empty())
+            return nullptr;
+        return reader;
+    }
+
+    ~SnapshotReader() { ::munmap(const_cast<char *>(base_), size_); }
+
+    SnapshotReader(const SnapshotReader &) = delete;
+    SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+    uint64_t record_count() const { return header_.record_count; }
+    int64_t created_ms() const { return header_.created_ms; }
+    bool clean() const { return header_.flags & kSnapshotClean; }
+
+    // Look key up through the hash table; false if absent or damaged
+    bool find(std::string_view key, SnapshotRecord &out) const
+    {
+        const uint64_t *slots = table();
+        const uint64_t mask = header_.table_slots - 1;
+        for (uint64_t i = snapshot_hash(key.data(), key.size()) & mask, n = 0; n <= mask; i = (i + 1) & mask, ++n)
+        {
+            if (slots[i] == 0)
+                return false;
+            uint64_t offset = slots[i] - 1;
+            SnapshotRecord rec;
+            if (read(offset, rec) && rec.key == key)
+            {
+                out = rec;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Offsets of all records in file (eviction) order. Taken from the
+    // checksummed table rather than by walking the records, so one damaged
+    // record cannot hide the ones after it.
+    std::vector<uint64_t> record_offsets() const
+    {
+        std::vector<uint64_t> offsets;
+        offsets.reserve(header_.record_count);
+        const uint64_t *slots = table();
+        for (uint64_t i = 0; i < header_.table_slots; ++i)
+            if (slots[i] != 0)
+                offsets.push_back(slots[i] - 1);
+        std::sort(offsets.begin(), offsets.end());
+        return offsets;
+    }
+
+    // Bounds- and checksum-checked read of the record at offset
+    bool read(uint64_t offset, SnapshotRecord &rec) const
+    {
+        if (offset < header_.records_offset || offset + sizeof(SnapshotRecordHeader) > header_.table_offset)
+            return false;
+        SnapshotRecordHeader rh;
+        std::memcpy(&rh, base_ + offset, sizeof(rh));
+        if (uint64_t(rh.key_size) + rh.value_size > header_.table_offset - offset - sizeof(rh))
+            return false;
+        const char *p = base_ + offset + sizeof(rh);
+        rec.key = std::string_view(p, rh.key_size);
+        rec.value = std::string_view(p + rh.key_size, rh.value_size);
+        rec.expires_at = rh.expires_at;
+        rec.flags = rh.flags;
+        return snapshot_record_checksum(rec.key, rec.value, rec.expires_at, rec.flags) == rh.checksum;
+    }
+
+private:
+    SnapshotReader(const char *base, size_t size) : base_(base), size_(size)
+    {
+        std::memcpy(&header_, base_, sizeof(header_));
+    }
+
+    const uint64_t *table() const { return reinterpret_cast<const uint64_t *>(base_ + header_.table_offset); }
+
+    const char *base_;
+    size_t size_;
+    SnapshotHeader header_;
+};
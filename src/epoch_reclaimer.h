@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// -------------------- Epoch-based reclamation --------------------
+// Lets readers walk a structure without locks while writers replace parts of
+// it. A reader brackets its accesses with an EpochGuard, which records the
+// global epoch it started in. A writer that unlinks a node passes it to a
+// RetireList instead of deleting it; the node is deleted once every reader
+// active at the time has left, i.e. once no active reader's recorded epoch
+// is as old as the epoch the node was retired in (with one epoch of slack,
+// as in classic EBR).
+//
+// Each reader thread owns a slot on its own cache line, so entering and
+// leaving a guard writes no shared memory. Writers advance the epoch and
+// delete in batches of kReclaimBatch. A thread claims a slot on its first
+// guard and frees it when it exits; if all kMaxThreads slots are taken the
+// guard is inactive and the caller must use its locked path.
+//
+// The epoch and the slots are process-wide, so any number of structures can
+// share them; each RetireList belongs to one structure and is used under
+// that structure's write lock.
+namespace epoch_detail
+{
+    constexpr size_t kMaxThreads = 256;
+
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> epoch{0}; // 0 = not in a guard
+        std::atomic<bool> claimed{false};
+    };
+
+    inline std::atomic<uint64_t> &global_epoch()
+    {
+        static std::atomic<uint64_t> epoch{1};
+        return epoch;
+    }
+
+    inline Slot *slots()
+    {
+        static Slot table[kMaxThreads];
+        return table;
+    }
+
+    // This thread's slot index, claimed on first use; kMaxThreads if none is free
+    struct ThreadSlot
+    {
+        size_t index = kMaxThreads;
+        int depth = 0; // nested guards
+
+        ThreadSlot()
+        {
+            for (size_t i = 0; i < kMaxThreads; ++i)
+            {
+                bool expected = false;
+                if (!slots()[i].claimed.load(std::memory_order_relaxed) &&
+                    slots()[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                {
+                    index = i;
+                    return;
+                }
+            }
+        }
+
+        ~ThreadSlot()
+        {
+            if (index < kMaxThreads)
+                slots()[index].claimed.store(false, std::memory_order_release);
+        }
+    };
+
+    inline ThreadSlot &thread_slot()
+    {
+        thread_local ThreadSlot slot;
+        return slot;
+    }
+
+    // Advance the epoch and return the oldest epoch an active reader may be
+    // in; anything retired before it is unreachable
+    inline uint64_t advance()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t oldest = global_epoch().fetch_add(1, std::memory_order_seq_cst) + 1;
+        for (size_t i = 0; i < kMaxThreads; ++i)
+        {
+            uint64_t e = slots()[i].epoch.load(std::memory_order_seq_cst);
+            if (e != 0)
+                oldest = std::min(oldest, e);
+        }
+        return oldest;
+    }
+}
+
+class EpochGuard
+{
+public:
+    static constexpr size_t kMaxThreads = epoch_detail::kMaxThreads;
+
+    EpochGuard() : thread_(epoch_detail::thread_slot())
+    {
+        if (thread_.index >= kMaxThreads || thread_.depth++ > 0)
+            return;
+        epoch_detail::Slot &slot = epoch_detail::slots()[thread_.index];
+        slot.epoch.store(epoch_detail::global_epoch().load(std::memory_order_seq_cst), std::memory_order_relaxed);
+        // The epoch must be visible before anything the reader loads next
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    ~EpochGuard()
+    {
+        if (thread_.index >= kMaxThreads || --thread_.depth > 0)
+            return;
+        epoch_detail::slots()[thread_.index].epoch.store(0, std::memory_order_release);
+    }
+
+    EpochGuard(const EpochGuard &) = delete;
+    EpochGuard &operator=(const EpochGuard &) = delete;
+
+    bool active() const { return thread_.index < kMaxThreads; }
+
+    // This thread's slot, 0..kMaxThreads-1; stable for the thread's lifetime
+    size_t slot() const { return thread_.index; }
+
+private:
+    epoch_detail::ThreadSlot &thread_;
+};
+
+class RetireList
+{
+public:
+    static constexpr size_t kReclaimBatch = 64;
+
+    RetireList() = default;
+    RetireList(const RetireList &) = delete;
+    RetireList &operator=(const RetireList &) = delete;
+
+    // Only once no reader can reach the structure any more
+    ~RetireList()
+    {
+        for (Retired &r : retired_)
+            r.destroy(r.ptr);
+    }
+
+    // p has been unlinked; delete it once no reader can still hold it
+    template <typename T>
+    void retire(const T *p)
+    {
+        // Read after the unlink, so a reader that may have missed the
+        // unlink is in this epoch or an older one
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = epoch_detail::global_epoch().load(std::memory_order_seq_cst);
+        retired_.push_back({const_cast<T *>(p), [](void *q)
+                            { delete static_cast<T *>(q); },
+                            epoch});
+        if (retired_.size() >= next_collect_)
+            collect();
+    }
+
+    size_t size() const { return retired_.size(); }
+
+    void collect()
+    {
+        uint64_t oldest = epoch_detail::advance();
+        auto keep = std::partition(retired_.begin(), retired_.end(), [&](const Retired &r)
+                                   { return r.epoch + 1 >= oldest; });
+        for (auto it = keep; it != retired_.end(); ++it)
+            it->destroy(it->ptr);
+        retired_.erase(keep, retired_.end());
+        // A reader that stays in one guard holds everything back; back off so
+        // retire() stays amortised O(1)
+        next_collect_ = std::max(kReclaimBatch, 2 * retired_.size());
+    }
+
+private:
+    struct Retired
+    {
+        void *ptr;
+        void (*destroy)(void *);
+        uint64_t epoch;
+    };
+
+    std::vector<Retired> retired_;
+    size_t next_collect_ = kReclaimBatch;
+};
@@ -0,0 +1,609 @@
+#pragma once
+
+#include "flat_cache_index.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// -------------------- Eviction policies --------------------
+// Each policy manages the eviction order of one cache shard over the entries
+// of its FlatCacheIndex. ShardedCache (sharded_cache.h) takes the policy as a
+// template parameter, so every call below is resolved at compile time.
+//
+// Interface (all calls with the shard lock held exclusively unless noted):
+//   kName                 name used in db.conf and /stats
+//   kSharedHits           true if on_hit() only touches Entry::freq, so hits
+//                         may run under a shared lock
+//   prepare_insert(hash)  a key not in the cache is about to be inserted;
+//                         called before any eviction made on its behalf
+//   on_insert(idx)        the entry was just inserted
+//   on_hit(idx)           lookup hit or in-place update
+//   victim()              entry to evict next (shard not empty); may reorder
+//                         internal queues while searching
+//   on_evict(idx)         victim() is being evicted for capacity
+//   on_erase(idx)         the entry is being removed explicitly (DELETE)
+//   for_each_in_order(f)  call f(idx) for every resident entry, roughly from
+//                         next to be evicted to last; read-only, so a shared
+//                         lock is enough
+
+// Bounded FIFO of key hashes for entries that were recently evicted
+// ("ghosts"). Used by 2Q, ARC and S3-FIFO to recognise keys that come back.
+class GhostQueue
+{
+public:
+    explicit GhostQueue(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+    size_t size() const { return live_.size(); }
+    bool contains(size_t hash) const { return live_.count(hash) > 0; }
+
+    // Returns whether the hash was present
+    bool remove(size_t hash) { return live_.erase(hash) > 0; }
+
+    void push(size_t hash)
+    {
+        live_[hash] = ++seq_;
+        fifo_.push_back({hash, seq_});
+        trim_to(capacity_);
+        // remove() leaves stale records behind; compact once they dominate
+        if (fifo_.size() > 2 * capacity_ + 16)
+            compact();
+    }
+
+    // Drop the oldest ghosts until at most n remain
+    void trim_to(size_t n)
+    {
+        while (live_.size() > n && !fifo_.empty())
+        {
+            auto oldest = fifo_.front();
+            fifo_.pop_front();
+            auto it = live_.find(oldest.first);
+            if (it != live_.end() && it->second == oldest.second)
+                live_.erase(it);
+        }
+    }
+
+private:
+    void compact()
+    {
+        std::deque<std::pair<size_t, uint64_t>> kept;
+        for (const auto &rec : fifo_)
+        {
+            auto it = live_.find(rec.first);
+            if (it != live_.end() && it->second == rec.second)
+                kept.push_back(rec);
+        }
+        fifo_.swap(kept);
+    }
+
+    size_t capacity_;
+    uint64_t seq_ = 0;
+    std::deque<std::pair<size_t, uint64_t>> fifo_; // (hash, seq), oldest first
+    std::unordered_map<size_t, uint64_t> live_;     // hash -> seq of its live record
+};
+
+// Exact LRU: one queue, hits move the entry to the newest end.
+class LruPolicy
+{
+public:
+    static constexpr const char *kName = "lru";
+    static constexpr bool kSharedHits = false;
+
+    LruPolicy(FlatCacheIndex &index, size_t /*capacity*/) : queue_(index) {}
+
+    void prepare_insert(size_t /*hash*/) {}
+    void on_insert(uint32_t idx) { queue_.push_back(idx); }
+    void on_hit(uint32_t idx) { queue_.move_to_back(idx); }
+    uint32_t victim() { return queue_.front(); }
+    void on_evict(uint32_t idx) { queue_.remove(idx); }
+    void on_erase(uint32_t idx) { queue_.remove(idx); }
+
+    template <typename F>
+    void for_each_in_order(F &&f) const { queue_.for_each(f); }
+
+private:
+    IndexList queue_;
+};
+
+// Second-chance CLOCK: the hand sweeps the slab as a ring. A hit only sets the
+// entry's reference bit, so hits can share the lock.
+class ClockPolicy
+{
+public:
+    static constexpr const char *kName = "clock";
+    static constexpr bool kSharedHits = true;
+
+    ClockPolicy(FlatCacheIndex &index, size_t /*capacity*/) : index_(index) {}
+
+    void prepare_insert(size_t /*hash*/) {}
+    void on_insert(uint32_t /*idx*/) {}
+
+    void on_hit(uint32_t idx)
+    {
+        std::atomic<uint8_t> &ref = index_.at(idx).freq;
+        if (ref.load(std::memory_order_relaxed) == 0)
+            ref.store(1, std::memory_order_relaxed);
+    }
+
+    // Give every referenced entry the hand passes a second chance
+    uint32_t victim()
+    {
+        while (true)
+        {
+            uint32_t idx = hand_;
+            hand_ = (hand_ + 1) % index_.capacity();
+
+            FlatCacheIndex::Entry &e = index_.at(idx);
+            if (!e.occupied)
+                continue;
+            if (e.freq.load(std::memory_order_relaxed) != 0)
+            {
+                e.freq.store(0, std::memory_order_relaxed);
+                continue;
+            }
+            return idx;
+        }
+    }
+
+    void on_evict(uint32_t /*idx*/) {}
+    void on_erase(uint32_t /*idx*/) {}
+
+    // Ring order starting at the hand
+    template <typename F>
+    void for_each_in_order(F &&f) const
+    {
+        for (uint32_t i = 0; i < index_.capacity(); ++i)
+        {
+            uint32_t idx = (hand_ + i) % index_.capacity();
+            if (index_.at(idx).occupied)
+                f(idx);
+        }
+    }
+
+private:
+    FlatCacheIndex &index_;
+    uint32_t hand_ = 0;
+};
+
+// 2Q (Johnson & Shasha, full version). New keys enter the A1in FIFO; a key
+// evicted from A1in is remembered in the A1out ghost queue, and if it is
+// requested again it goes straight into the Am LRU. Hits in A1in do nothing,
+// so a one-time scan never displaces Am.
+class TwoQueuePolicy
+{
+public:
+    static constexpr const char *kName = "2q";
+    static constexpr bool kSharedHits = false;
+
+    TwoQueuePolicy(FlatCacheIndex &index, size_t capacity)
+        : index_(index), a1in_(index), am_(index), a1out_(capacity / 2),
+          kin_(std::max<size_t>(capacity / 4, 1))
+    {
+    }
+
+    void prepare_insert(size_t hash) { seen_before_ = a1out_.remove(hash); }
+
+    void on_insert(uint32_t idx)
+    {
+        index_.at(idx).queue = seen_before_ ? kAm : kA1in;
+        (seen_before_ ? am_ : a1in_).push_back(idx);
+        seen_before_ = false;
+    }
+
+    void on_hit(uint32_t idx)
+    {
+        if (index_.at(idx).queue == kAm)
+            am_.move_to_back(idx);
+    }
+
+    uint32_t victim() { return (a1in_.size() > kin_ || am_.empty()) ? a1in_.front() : am_.front(); }
+
+    void on_evict(uint32_t idx)
+    {
+        FlatCacheIndex::Entry &e = index_.at(idx);
+        if (e.queue == kA1in)
+            a1out_.push(e.hash);
+        on_erase(idx);
+    }
+
+    void on_erase(uint32_t idx) { (index_.at(idx).queue == kAm ? am_ : a1in_).remove(idx); }
+
+    template <typename F>
+    void for_each_in_order(F &&f) const
+    {
+        a1in_.for_each(f);
+        am_.for_each(f);
+    }
+
+private:
+    static constexpr uint8_t kA1in = 0;
+    static constexpr uint8_t kAm = 1;
+
+    FlatCacheIndex &index_;
+    IndexList a1in_;
+    IndexList am_;
+    GhostQueue a1out_;
+    size_t kin_;
+    bool seen_before_ = false;
+};
+
+// ARC (Megiddo & Modha). T1 holds keys seen once recently, T2 keys seen at
+// least twice; B1/B2 are their ghost lists. A ghost hit in B1 grows the
+// target size p of T1, a ghost hit in B2 shrinks it, so the split between
+// recency and frequency adapts to the workload.
+class ArcPolicy
+{
+public:
+    static constexpr const char *kName = "arc";
+    static constexpr bool kSharedHits = false;
+
+    ArcPolicy(FlatCacheIndex &index, size_t capacity)
+        : index_(index), capacity_(std::max<size_t>(capacity, 1)), t1_(index), t2_(index), b1_(capacity),
+          b2_(capacity)
+    {
+    }
+
+    void prepare_insert(size_t hash)
+    {
+        ghost_ = kNone;
+        if (b1_.contains(hash))
+        {
+            size_t delta = std::max<size_t>(b1_.size() ? b2_.size() / b1_.size() : 1, 1);
+            p_ = std::min(capacity_, p_ + delta);
+            b1_.remove(hash);
+            ghost_ = kInB1;
+        }
+        else if (b2_.contains(hash))
+        {
+            size_t delta = std::max<size_t>(b2_.size() ? b1_.size() / b2_.size() : 1, 1);
+            p_ -= std::min(p_, delta);
+            b2_.remove(hash);
+            ghost_ = kInB2;
+        }
+    }
+
+    void on_insert(uint32_t idx)
+    {
+        bool frequent = ghost_ != kNone;
+        index_.at(idx).queue = frequent ? kT2 : kT1;
+        (frequent ? t2_ : t1_).push_back(idx);
+        ghost_ = kNone;
+    }
+
+    void on_hit(uint32_t idx)
+    {
+        FlatCacheIndex::Entry &e = index_.at(idx);
+        if (e.queue == kT1)
+        {
+            t1_.remove(idx);
+            t2_.push_back(idx);
+            e.queue = kT2;
+        }
+        else
+        {
+            t2_.move_to_back(idx);
+        }
+    }
+
+    // ARC's REPLACE step
+    uint32_t victim()
+    {
+        bool from_t1 = !t1_.empty() &&
+                       (t1_.size() > p_ || (ghost_ == kInB2 && t1_.size() == p_) || t2_.empty());
+        return from_t1 ? t1_.front() : t2_.front();
+    }
+
+    void on_evict(uint32_t idx)
+    {
+        FlatCacheIndex::Entry &e = index_.at(idx);
+        if (e.queue == kT1)
+        {
+            t1_.remove(idx);
+            b1_.push(e.hash);
+        }
+        else
+        {
+            t2_.remove(idx);
+            b2_.push(e.hash);
+        }
+        // Directory bounds: |T1|+|B1| <= c and |T1|+|T2|+|B1|+|B2| <= 2c
+        b1_.trim_to(capacity_ > t1_.size() ? capacity_ - t1_.size() : 0);
+        size_t resident = t1_.size() + t2_.size() + b1_.size();
+        b2_.trim_to(2 * capacity_ > resident ? 2 * capacity_ - resident : 0);
+    }
+
+    void on_erase(uint32_t idx) { (index_.at(idx).queue == kT2 ? t2_ : t1_).remove(idx); }
+
+    template <typename F>
+    void for_each_in_order(F &&f) const
+    {
+        t1_.for_each(f);
+        t2_.for_each(f);
+    }
+
+    size_t target_t1() const { return p_; }
+
+private:
+    static constexpr uint8_t kT1 = 0;
+    static constexpr uint8_t kT2 = 1;
+    enum Ghost
+    {
+        kNone,
+        kInB1,
+        kInB2
+    };
+
+    FlatCacheIndex &index_;
+    size_t capacity_;
+    IndexList t1_;
+    IndexList t2_;
+    GhostQueue b1_;
+    GhostQueue b2_;
+    size_t p_ = 0; // target size of T1
+    Ghost ghost_ = kNone;
+};
+
+// S3-FIFO (Yang et al., SOSP'23). Three FIFO queues: a small queue S (10% of
+// capacity) that new keys enter, a main queue M, and a ghost queue G. When S
+// is over its share, its oldest entry moves to M if it was hit more than once
+// and is evicted into G otherwise; keys found in G are inserted directly into
+// M. M evicts with CLOCK-style reinsertion driven by a 2-bit counter. A hit
+// only bumps that counter, so hits can share the lock.
+class S3FifoPolicy
+{
+public:
+    static constexpr const char *kName = "s3fifo";
+    static constexpr bool kSharedHits = true;
+
+    S3FifoPolicy(FlatCacheIndex &index, size_t capacity)
+        : index_(index), small_(index), main_(index), small_target_(std::max<size_t>(capacity / 10, 1)),
+          ghost_(capacity > small_target_ ? capacity - small_target_ : 1)
+    {
+    }
+
+    void prepare_insert(size_t hash) { seen_before_ = ghost_.remove(hash); }
+
+    void on_insert(uint32_t idx)
+    {
+        index_.at(idx).queue = seen_before_ ? kMain : kSmall;
+        (seen_before_ ? main_ : small_).push_back(idx);
+        seen_before_ = false;
+    }
+
+    void on_hit(uint32_t idx)
+    {
+        std::atomic<uint8_t> &freq = index_.at(idx).freq;
+        uint8_t f = freq.load(std::memory_order_relaxed);
+        if (f < kMaxFreq)
+            freq.store(f + 1, std::memory_order_relaxed);
+    }
+
+    uint32_t victim()
+    {
+        while (true)
+        {
+            if (!small_.empty() && (small_.size() >= small_target_ || main_.empty()))
+            {
+                uint32_t idx = small_.front();
+                FlatCacheIndex::Entry &e = index_.at(idx);
+                if (e.freq.load(std::memory_order_relaxed) <= 1)
+                    return idx;
+                small_.remove(idx);
+                main_.push_back(idx);
+                e.queue = kMain;
+                e.freq.store(0, std::memory_order_relaxed);
+            }
+            else
+            {
+                uint32_t idx = main_.front();
+                FlatCacheIndex::Entry &e = index_.at(idx);
+                uint8_t f = e.freq.load(std::memory_order_relaxed);
+                if (f == 0)
+                    return idx;
+                main_.move_to_back(idx);
+                e.freq.store(f - 1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void on_evict(uint32_t idx)
+    {
+        FlatCacheIndex::Entry &e = index_.at(idx);
+        if (e.queue == kSmall)
+            ghost_.push(e.hash);
+        on_erase(idx);
+    }
+
+    void on_erase(uint32_t idx) { (index_.at(idx).queue == kMain ? main_ : small_).remove(idx); }
+
+    template <typename F>
+    void for_each_in_order(F &&f) const
+    {
+        small_.for_each(f);
+        main_.for_each(f);
+    }
+
+private:
+    static constexpr uint8_t kSmall = 0;
+    static constexpr uint8_t kMain = 1;
+    static constexpr uint8_t kMaxFreq = 3;
+
+    FlatCacheIndex &index_;
+    IndexList small_;
+    IndexList main_;
+    size_t small_target_;
+    GhostQueue ghost_;
+    bool seen_before_ = false;
+};
+
+// GreedyDual-Size-Frequency (Cherkasova, 1998). Each entry's priority is
+// L + frequency * cost / size, where cost is the time the entry took to fetch
+// (Entry::cost_us, set by the cache) and size its entry_bytes(); the entry
+// with the lowest priority is evicted and its priority becomes the new
+// inflation value L, so entries that are not hit again age out. Entries with
+// unknown cost (0) are charged the mean known cost of the cached entries.
+// Priorities live in an indexed binary min-heap, so hits and evictions are
+// O(log n).
+class GdsfPolicy
+{
+public:
+    static constexpr const char *kName = "gdsf";
+    static constexpr bool kSharedHits = false;
+
+    GdsfPolicy(FlatCacheIndex &index, size_t capacity)
+        : index_(index), pos_(index.capacity(), kNotQueued), priority_(index.capacity(), 0),
+          freq_(index.capacity(), 0), counted_cost_(index.capacity(), 0)
+    {
+        heap_.reserve(capacity);
+    }
+
+    void prepare_insert(size_t /*hash*/) {}
+
+    void on_insert(uint32_t idx)
+    {
+        count_cost(idx);
+        freq_[idx] = 1;
+        priority_[idx] = value_of(idx);
+        pos_[idx] = static_cast<uint32_t>(heap_.size());
+        heap_.push_back(idx);
+        sift_up(pos_[idx]);
+    }
+
+    // Also called after an in-place update, which may change size and cost
+    void on_hit(uint32_t idx)
+    {
+        if (freq_[idx] < kMaxFreq)
+            freq_[idx]++;
+        if (index_.at(idx).cost_us != counted_cost_[idx])
+        {
+            uncount_cost(idx);
+            count_cost(idx);
+        }
+        priority_[idx] = value_of(idx);
+        sift_down(pos_[idx]);
+        sift_up(pos_[idx]);
+    }
+
+    uint32_t victim() { return heap_.front(); }
+
+    void on_evict(uint32_t idx)
+    {
+        inflation_ = priority_[idx];
+        on_erase(idx);
+    }
+
+    void on_erase(uint32_t idx)
+    {
+        uncount_cost(idx);
+        uint32_t pos = pos_[idx];
+        uint32_t last = heap_.back();
+        heap_.pop_back();
+        pos_[idx] = kNotQueued;
+        if (last == idx)
+            return;
+        heap_[pos] = last;
+        pos_[last] = pos;
+        sift_down(pos);
+        sift_up(pos);
+    }
+
+    // Lowest priority first
+    template <typename F>
+    void for_each_in_order(F &&f) const
+    {
+        std::vector<uint32_t> order(heap_);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+                  { return priority_[a] < priority_[b]; });
+        for (uint32_t idx : order)
+            f(idx);
+    }
+
+    double inflation() const { return inflation_; }
+
+private:
+    static constexpr uint32_t kNotQueued = UINT32_MAX;
+    static constexpr uint32_t kMaxFreq = 1u << 20;
+
+    // Add idx's known cost to the mean; counted_cost_ remembers what was
+    // added so a replace or an erase takes out exactly that
+    void count_cost(uint32_t idx)
+    {
+        counted_cost_[idx] = index_.at(idx).cost_us;
+        if (counted_cost_[idx] > 0)
+        {
+            cost_sum_ += counted_cost_[idx];
+            cost_count_++;
+        }
+    }
+
+    void uncount_cost(uint32_t idx)
+    {
+        if (counted_cost_[idx] > 0)
+        {
+            cost_sum_ -= counted_cost_[idx];
+            cost_count_--;
+        }
+        counted_cost_[idx] = 0;
+    }
+
+    // freq * cost / size, on top of the current inflation value
+    double value_of(uint32_t idx) const
+    {
+        const FlatCacheIndex::Entry &e = index_.at(idx);
+        double cost = e.cost_us;
+        if (e.cost_us == 0)
+            cost = cost_count_ > 0 ? cost_sum_ / cost_count_ : 1;
+        double size = static_cast<double>(index_.entry_bytes(e.key_size, e.value_size));
+        return inflation_ + freq_[idx] * cost / std::max(size, 1.0);
+    }
+
+    void sift_up(uint32_t pos)
+    {
+        uint32_t idx = heap_[pos];
+        while (pos > 0)
+        {
+            uint32_t parent = (pos - 1) / 2;
+            if (priority_[heap_[parent]] <= priority_[idx])
+                break;
+            heap_[pos] = heap_[parent];
+            pos_[heap_[pos]] = pos;
+            pos = parent;
+        }
+        heap_[pos] = idx;
+        pos_[idx] = pos;
+    }
+
+    void sift_down(uint32_t pos)
+    {
+        uint32_t idx = heap_[pos];
+        uint32_t n = static_cast<uint32_t>(heap_.size());
+        while (true)
+        {
+            uint32_t child = 2 * pos + 1;
+            if (child >= n)
+                break;
+            if (child + 1 < n && priority_[heap_[child + 1]] < priority_[heap_[child]])
+                child++;
+            if (priority_[idx] <= priority_[heap_[child]])
+                break;
+            heap_[pos] = heap_[child];
+            pos_[heap_[pos]] = pos;
+            pos = child;
+        }
+        heap_[pos] = idx;
+        pos_[idx] = pos;
+    }
+
+    FlatCacheIndex &index_;
+    std::vector<uint32_t> heap_;         // entry indexes, min-heap by priority
+    std::vector<uint32_t> pos_;          // heap position of each entry
+    std::vector<double> priority_;       // by entry index
+    std::vector<uint32_t> freq_;         // by entry index
+    std::vector<uint32_t> counted_cost_; // by entry index: its cost_us in cost_sum_
+    double inflation_ = 0;               // L
+    double cost_sum_ = 0;                // known costs of cached entries, for entries without one
+    size_t cost_count_ = 0;
+};
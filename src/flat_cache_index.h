@@ -0,0 +1,436 @@
+#pragma once
+
+#include "slab_allocator.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// -------------------- Flat cache index (SwissTable layout) --------------------
+// Index for one cache shard, replacing list<pair<key,value>> + unordered_map.
+//
+//  - Entries live in an array allocated once for the shard's capacity. Each
+//    entry's key and value bytes sit back to back in one chunk from the
+//    shard's SlabAllocator, so a put or an eviction never calls malloc/free
+//    for small items.
+//  - Values of shared_value_bytes or more are kept instead in an immutable
+//    refcounted buffer (SharedValue) and only the key goes in the slab.
+//    Readers take a reference instead of copying the payload, and a buffer
+//    that is evicted or replaced lives on until its last reader drops it.
+//  - The hash table is two parallel arrays: one control byte per slot (the
+//    low 7 bits of the hash, or EMPTY/DELETED) and the entry index stored in
+//    that slot. A probe loads a group of 16 control bytes, compares them
+//    against the key's tag with one SSE2 compare, and only reads entries
+//    whose tag matches.
+//  - Each entry carries prev/next entry indices, a queue tag and a small
+//    frequency counter for the eviction policy. Policies thread their queues
+//    through the entries with IndexList (below), so there are no pointers.
+//
+// The index also keeps a running total of entry_bytes() over live entries so
+// the cache can enforce a byte budget. entry_bytes() charges the slab chunk an
+// item occupies, not just its payload, so the budget covers internal
+// fragmentation. An owner that keeps a second copy of every entry outside
+// the index (RcuLocking's RcuIndex mirror) passes the copy's fixed size as
+// copy_overhead, and each entry is charged that plus the copied key and
+// (unshared) value as well.
+//
+// Not thread-safe; the owning shard's lock protects it. The only field that
+// may be written under a shared lock is Entry::freq.
+class FlatCacheIndex
+{
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+    static constexpr size_t kDefaultSharedValueBytes = 4096;
+
+    using SharedValue = std::shared_ptr<const std::string>;
+
+    struct Entry
+    {
+        char *data = nullptr; // key bytes, then value bytes unless shared, from the slab allocator
+        SharedValue shared;   // large values live here instead
+        uint32_t key_size = 0;
+        uint32_t value_size = 0;
+        size_t hash = 0;
+        int64_t expires_at = 0; // unix ms, 0 = never
+        int64_t stored_at = 0;  // unix ms the value was written (set by the cache)
+        uint64_t version = 0;   // writer's version of the value (set by the cache)
+        uint32_t prev = npos; // older neighbour in the policy queue
+        uint32_t next = npos; // newer neighbour in the policy queue
+        uint32_t pos = 0;     // table slot holding this entry
+        uint32_t cost_us = 0; // time the value took to fetch, 0 = unknown (set by the cache)
+        std::atomic<uint8_t> freq{0}; // reference bit / access counter
+        uint8_t queue = 0;            // which policy queue holds the entry
+        uint8_t flags = 0;            // value encoding, opaque to the index (set by the cache)
+        bool occupied = false;
+
+        std::string_view key() const { return std::string_view(data, key_size); }
+        std::string_view value() const
+        {
+            return shared ? std::string_view(*shared) : std::string_view(data + key_size, value_size);
+        }
+    };
+
+    explicit FlatCacheIndex(uint32_t capacity, size_t slab_page_bytes = SlabAllocator::kDefaultPageBytes,
+                            double slab_growth_factor = SlabAllocator::kDefaultGrowthFactor,
+                            size_t shared_value_bytes = kDefaultSharedValueBytes, size_t copy_overhead = 0)
+        : capacity_(capacity), shared_value_bytes_(shared_value_bytes), copy_overhead_(copy_overhead), entries_(new Entry[capacity > 0 ? capacity : 1]),
+          arena_(slab_page_bytes, slab_growth_factor)
+    {
+        // Keep the table at most 7/8 full so probes always reach an empty slot
+        size_t wanted = static_cast<size_t>(capacity) + capacity / 7 + 1;
+        size_t groups = 1;
+        while (groups * kGroupWidth < wanted)
+            groups <<= 1;
+        group_mask_ = groups - 1;
+        ctrl_.assign(groups * kGroupWidth, kEmpty);
+        slots_.assign(groups * kGroupWidth, npos);
+        max_load_ = ctrl_.size() - ctrl_.size() / 8;
+        growth_left_ = max_load_;
+
+        // Hand out entries from the front of the array first
+        free_.reserve(capacity);
+        for (uint32_t i = capacity; i > 0; --i)
+            free_.push_back(i - 1);
+    }
+
+    ~FlatCacheIndex()
+    {
+        for (uint32_t idx = 0; idx < capacity_; ++idx)
+            if (entries_[idx].occupied)
+                arena_.deallocate(entries_[idx].data, chunk_request(entries_[idx].key_size, entries_[idx].value_size));
+    }
+
+    // Bytes charged for one entry: the slab chunk holding key and value (or
+    // the key plus a shared value buffer), the fixed cost of its entry,
+    // control byte and slot index, and the owner's copy if it keeps one.
+    size_t entry_bytes(size_t key_size, size_t value_size) const
+    {
+        size_t payload = arena_.chunk_size(chunk_request(key_size, value_size));
+        if (shares(value_size))
+            payload += value_size + kSharedOverhead;
+        if (copy_overhead_ > 0)
+            payload += copy_overhead_ + key_size + (shares(value_size) ? 0 : value_size);
+        return payload + sizeof(Entry) + sizeof(int8_t) + sizeof(uint32_t);
+    }
+
+    bool shares(size_t value_size) const { return value_size >= shared_value_bytes_; }
+
+    FlatCacheIndex(const FlatCacheIndex &) = delete;
+    FlatCacheIndex &operator=(const FlatCacheIndex &) = delete;
+
+    uint32_t size() const { return size_; }
+    uint32_t capacity() const { return capacity_; }
+    bool full() const { return size_ >= capacity_; }
+    size_t bytes() const { return bytes_; }
+    SlabAllocator::Stats slab_stats() const { return arena_.stats(); }
+
+    Entry &at(uint32_t idx) { return entries_[idx]; }
+    const Entry &at(uint32_t idx) const { return entries_[idx]; }
+
+    // Entry index of key, or npos
+    uint32_t find(std::string_view key, size_t hash) const
+    {
+        const int8_t tag = tag_of(hash);
+        size_t group = (hash >> 7) & group_mask_;
+        for (size_t step = 1; step <= group_mask_ + 1; ++step)
+        {
+            const size_t base = group * kGroupWidth;
+            uint32_t match = match_byte(&ctrl_[base], tag);
+            while (match)
+            {
+                uint32_t idx = slots_[base + __builtin_ctz(match)];
+                const Entry &e = entries_[idx];
+                if (e.hash == hash && e.key() == key)
+                    return idx;
+                match &= match - 1;
+            }
+            if (match_byte(&ctrl_[base], kEmpty))
+                return npos;
+            group = (group + step) & group_mask_;
+        }
+        return npos;
+    }
+
+    // Insert a key that is not present. Caller must make room first (!full()).
+    // The entry is not linked into any queue; that is the policy's job.
+    // A large value adopts shared_value when given (it must hold the same
+    // bytes as value), otherwise it is copied into a new buffer.
+    uint32_t insert(std::string_view key, std::string_view value, size_t hash, int64_t expires_at = 0,
+                    const SharedValue &shared_value = nullptr)
+    {
+        if (growth_left_ == 0)
+            rehash_in_place();
+
+        uint32_t idx = free_.back();
+        free_.pop_back();
+
+        size_t pos = find_insert_pos(hash);
+        if (ctrl_[pos] == kEmpty)
+            --growth_left_;
+        ctrl_[pos] = tag_of(hash);
+        slots_[pos] = idx;
+
+        Entry &e = entries_[idx];
+        e.data = static_cast<char *>(arena_.allocate(chunk_request(key.size(), value.size())));
+        std::memcpy(e.data, key.data(), key.size());
+        set_value(e, key.size(), value, shared_value);
+        e.key_size = static_cast<uint32_t>(key.size());
+        e.value_size = static_cast<uint32_t>(value.size());
+        e.hash = hash;
+        e.expires_at = expires_at;
+        e.pos = static_cast<uint32_t>(pos);
+        e.prev = e.next = npos;
+        e.freq.store(0, std::memory_order_relaxed);
+        e.queue = 0;
+        e.occupied = true;
+        ++size_;
+        bytes_ += entry_bytes(e.key_size, e.value_size);
+        return idx;
+    }
+
+    // Replace the value of a live entry; the chunk is reused when the new
+    // size falls in the same size class. shared_value as for insert().
+    void assign(uint32_t idx, std::string_view value, const SharedValue &shared_value = nullptr)
+    {
+        Entry &e = entries_[idx];
+        const size_t old_size = chunk_request(e.key_size, e.value_size);
+        const size_t new_size = chunk_request(e.key_size, value.size());
+        bytes_ -= entry_bytes(e.key_size, e.value_size);
+        if (arena_.chunk_size(new_size) != arena_.chunk_size(old_size))
+        {
+            char *data = static_cast<char *>(arena_.allocate(new_size));
+            std::memcpy(data, e.data, e.key_size);
+            arena_.deallocate(e.data, old_size);
+            e.data = data;
+        }
+        else if (old_size != new_size)
+        {
+            // Same chunk; keep the allocator's requested-byte count exact
+            arena_.resize_in_place(old_size, new_size);
+        }
+        set_value(e, e.key_size, value, shared_value);
+        e.value_size = static_cast<uint32_t>(value.size());
+        bytes_ += entry_bytes(e.key_size, e.value_size);
+    }
+
+    // Remove a live entry. The policy must already have unlinked it.
+    void erase(uint32_t idx)
+    {
+        Entry &e = entries_[idx];
+        const size_t base = (e.pos / kGroupWidth) * kGroupWidth;
+        // A group that still has an EMPTY byte never made a probe continue
+        // past it, so the slot can go straight back to EMPTY.
+        if (match_byte(&ctrl_[base], kEmpty))
+        {
+            ctrl_[e.pos] = kEmpty;
+            ++growth_left_;
+        }
+        else
+        {
+            ctrl_[e.pos] = kDeleted;
+        }
+        slots_[e.pos] = npos;
+
+        bytes_ -= entry_bytes(e.key_size, e.value_size);
+        arena_.deallocate(e.data, chunk_request(e.key_size, e.value_size));
+        e.data = nullptr;
+        e.shared.reset();
+        e.key_size = e.value_size = 0;
+        e.occupied = false;
+        free_.push_back(idx);
+        --size_;
+    }
+
+    // Approximate heap footprint of the index itself (entries + table),
+    // excluding the slab pages that hold keys and values.
+    size_t footprint_bytes() const
+    {
+        return sizeof(*this) + static_cast<size_t>(capacity_) * sizeof(Entry) +
+               ctrl_.capacity() * sizeof(int8_t) + slots_.capacity() * sizeof(uint32_t) +
+               free_.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    static constexpr size_t kGroupWidth = 16;
+    static constexpr int8_t kEmpty = -128;  // 0b10000000
+    static constexpr int8_t kDeleted = -2;  // 0b11111110
+
+    // Approximate heap cost of a shared buffer beyond its payload
+    // (shared_ptr control block and string header)
+    static constexpr size_t kSharedOverhead = 64;
+
+    static int8_t tag_of(size_t hash) { return static_cast<int8_t>(hash & 0x7F); }
+
+    // Bytes requested from the slab for an entry
+    size_t chunk_request(size_t key_size, size_t value_size) const
+    {
+        return shares(value_size) ? key_size : key_size + value_size;
+    }
+
+    // Store value after the key_size key bytes already in e.data
+    void set_value(Entry &e, size_t key_size, std::string_view value, const SharedValue &shared_value)
+    {
+        if (!shares(value.size()))
+        {
+            e.shared.reset();
+            std::memcpy(e.data + key_size, value.data(), value.size());
+        }
+        else if (shared_value)
+        {
+            e.shared = shared_value;
+        }
+        else
+        {
+            e.shared = std::make_shared<const std::string>(value);
+        }
+    }
+
+    // Bit i set where group[i] == b
+    static uint32_t match_byte(const int8_t *group, int8_t b)
+    {
+#if defined(__SSE2__)
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i)
+            if (group[i] == b)
+                mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    // Bit i set where group[i] is EMPTY or DELETED (both have the sign bit set)
+    static uint32_t match_free(const int8_t *group)
+    {
+#if defined(__SSE2__)
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i)
+            if (group[i] < 0)
+                mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    size_t find_insert_pos(size_t hash) const
+    {
+        size_t group = (hash >> 7) & group_mask_;
+        for (size_t step = 1;; ++step)
+        {
+            const size_t base = group * kGroupWidth;
+            uint32_t free_mask = match_free(&ctrl_[base]);
+            if (free_mask)
+                return base + __builtin_ctz(free_mask);
+            group = (group + step) & group_mask_;
+        }
+    }
+
+    // Drop all DELETED markers by re-placing every live entry
+    void rehash_in_place()
+    {
+        ctrl_.assign(ctrl_.size(), kEmpty);
+        slots_.assign(slots_.size(), npos);
+        for (uint32_t idx = 0; idx < capacity_; ++idx)
+        {
+            Entry &e = entries_[idx];
+            if (!e.occupied)
+                continue;
+            size_t pos = find_insert_pos(e.hash);
+            ctrl_[pos] = tag_of(e.hash);
+            slots_[pos] = idx;
+            e.pos = static_cast<uint32_t>(pos);
+        }
+        growth_left_ = max_load_ - size_;
+    }
+
+    uint32_t capacity_;
+    size_t shared_value_bytes_;
+    size_t copy_overhead_; // 0 = entries are not copied elsewhere
+    uint32_t size_ = 0;
+    size_t bytes_ = 0;
+    std::unique_ptr<Entry[]> entries_;
+    std::vector<uint32_t> free_;
+    SlabAllocator arena_;
+
+    std::vector<int8_t> ctrl_;
+    std::vector<uint32_t> slots_;
+    size_t group_mask_ = 0;
+    size_t max_load_ = 0;
+    size_t growth_left_ = 0;
+};
+
+// Intrusive doubly linked queue of FlatCacheIndex entries, linked through
+// Entry::prev/next. front() is the oldest entry, back() the newest. An entry
+// may be in at most one IndexList at a time.
+class IndexList
+{
+public:
+    explicit IndexList(FlatCacheIndex &index) : index_(index) {}
+
+    uint32_t front() const { return head_; }
+    uint32_t back() const { return tail_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    void push_back(uint32_t idx)
+    {
+        FlatCacheIndex::Entry &e = index_.at(idx);
+        e.prev = tail_;
+        e.next = FlatCacheIndex::npos;
+        if (tail_ != FlatCacheIndex::npos)
+            index_.at(tail_).next = idx;
+        else
+            head_ = idx;
+        tail_ = idx;
+        ++size_;
+    }
+
+    void remove(uint32_t idx)
+    {
+        FlatCacheIndex::Entry &e = index_.at(idx);
+        if (e.prev != FlatCacheIndex::npos)
+            index_.at(e.prev).next = e.next;
+        else
+            head_ = e.next;
+        if (e.next != FlatCacheIndex::npos)
+            index_.at(e.next).prev = e.prev;
+        else
+            tail_ = e.prev;
+        e.prev = e.next = FlatCacheIndex::npos;
+        --size_;
+    }
+
+    void move_to_back(uint32_t idx)
+    {
+        if (idx == tail_)
+            return;
+        remove(idx);
+        push_back(idx);
+    }
+
+    // Visit entries from front to back
+    template <typename F>
+    void for_each(F &&f) const
+    {
+        for (uint32_t idx = head_; idx != FlatCacheIndex::npos; idx = index_.at(idx).next)
+            f(idx);
+    }
+
+private:
+    FlatCacheIndex &index_;
+    uint32_t head_ = FlatCacheIndex::npos;
+    uint32_t tail_ = FlatCacheIndex::npos;
+    size_t size_ = 0;
+};
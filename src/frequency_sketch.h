@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// -------------------- Count-min frequency sketch (TinyLFU) --------------------
+// Approximate access counts for one cache shard. Four rows of saturating
+// 4-bit-range counters (kept one per byte) are indexed by independent mixes of
+// the key hash; the estimate is the minimum over the rows. Increments are
+// conservative (only the rows holding the current minimum are bumped), which
+// keeps over-counting from collisions low.
+//
+// After sample_size recorded accesses every counter is halved, so old
+// popularity fades and the sketch tracks the recent access distribution.
+//
+// All counters are relaxed atomics: record() may run under a shared lock or no
+// lock at all. A lost increment under a race only makes the estimate slightly
+// low, which is acceptable for an admission heuristic.
+class FrequencySketch
+{
+public:
+    static constexpr uint8_t kMaxCount = 15;
+
+    explicit FrequencySketch(size_t capacity)
+    {
+        size_t wanted = std::max<size_t>(capacity, 16);
+        width_ = 1;
+        while (width_ < wanted)
+            width_ <<= 1;
+        sample_size_ = 10 * std::max<size_t>(capacity, 1);
+        counters_.reset(new std::atomic<uint8_t>[kRows * width_]);
+        for (size_t i = 0; i < kRows * width_; ++i)
+            counters_[i].store(0, std::memory_order_relaxed);
+    }
+
+    FrequencySketch(const FrequencySketch &) = delete;
+    FrequencySketch &operator=(const FrequencySketch &) = delete;
+
+    void record(size_t hash)
+    {
+        uint8_t current = estimate(hash);
+        if (current < kMaxCount)
+        {
+            for (size_t row = 0; row < kRows; ++row)
+            {
+                std::atomic<uint8_t> &c = counters_[slot(hash, row)];
+                if (c.load(std::memory_order_relaxed) == current)
+                    c.store(current + 1, std::memory_order_relaxed);
+            }
+        }
+
+        size_t n = additions_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (n >= sample_size_ && additions_.compare_exchange_strong(n, n / 2, std::memory_order_relaxed))
+            age();
+    }
+
+    uint8_t estimate(size_t hash) const
+    {
+        uint8_t freq = kMaxCount;
+        for (size_t row = 0; row < kRows; ++row)
+            freq = std::min(freq, counters_[slot(hash, row)].load(std::memory_order_relaxed));
+        return freq;
+    }
+
+    long long resets() const { return resets_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kRows = 4;
+
+    size_t slot(size_t hash, size_t row) const
+    {
+        static const uint64_t seeds[kRows] = {0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+                                              0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL};
+        uint64_t h = (static_cast<uint64_t>(hash) + seeds[row]) * seeds[(row + 1) % kRows];
+        h ^= h >> 32;
+        return row * width_ + (h & (width_ - 1));
+    }
+
+    // Halve every counter
+    void age()
+    {
+        for (size_t i = 0; i < kRows * width_; ++i)
+            counters_[i].store(counters_[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+        resets_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t width_ = 0;
+    size_t sample_size_ = 0;
+    std::unique_ptr<std::atomic<uint8_t>[]> counters_;
+    std::atomic<size_t> additions_{0};
+    std::atomic<long long> resets_{0};
+};
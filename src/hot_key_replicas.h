@@ -0,0 +1,199 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "flat_cache_index.h"
+#include "timer_wheel.h"
+
+// -------------------- Hot-key replicas --------------------
+// Per-thread read-only copies of the hottest keys, for /kv_popular. Each
+// worker thread counts the reads it serves over kWindow; a key it reads at
+// least threshold times in one window is copied into that thread's replica
+// table, and from then on that thread serves it without touching any shared
+// cache line other than one load of the key's version stripe. A replica
+// that falls below the threshold for a whole window is dropped.
+//
+// Invalidation: writers bump the version stripe of the key (one of kStripes
+// counters, picked by hash) after updating the shared cache. A reader takes
+// the stripe version before its shared-cache lookup and the replica keeps
+// it; a replica is only served while its stripe still has that version.
+// Expiring keys carry their deadline into the replica.
+//
+// Each thread owns its state (tables and counters); stats() only reads the
+// counters. Thread state lives as long as the process, which suits a fixed
+// pool of worker threads. Use a single instance per process.
+class HotKeyReplicas
+{
+public:
+    using SharedValue = FlatCacheIndex::SharedValue;
+    using clock = std::chrono::steady_clock;
+    static constexpr std::chrono::milliseconds kWindow{1000};
+
+    struct Stats
+    {
+        long long hits = 0;
+        long long promotions = 0;
+        long long invalidations = 0;
+        long long replicas = 0;
+        long long threads = 0;
+    };
+
+    // threshold: reads per window by one thread that make a key hot (0 = off).
+    // capacity: replicas per thread.
+    HotKeyReplicas(size_t threshold, size_t capacity) : threshold_(threshold), capacity_(capacity) {}
+
+    HotKeyReplicas(const HotKeyReplicas &) = delete;
+    HotKeyReplicas &operator=(const HotKeyReplicas &) = delete;
+
+    bool enabled() const { return threshold_ > 0 && capacity_ > 0; }
+
+    // Version to pass to offer(); read before the shared-cache lookup
+    uint64_t version(size_t hash) const { return stripes_[hash & (kStripes - 1)].load(std::memory_order_acquire); }
+
+    // Call after a write or delete of the key has reached the shared cache
+    void invalidate(size_t hash)
+    {
+        if (enabled())
+            stripes_[hash & (kStripes - 1)].fetch_add(1, std::memory_order_release);
+    }
+
+    // Serve key from this thread's replicas. A miss counts the read towards
+    // making the key hot.
+    bool get(const std::string &key, size_t hash, SharedValue &out)
+    {
+        ThreadState &ts = local();
+        roll_window(ts);
+        auto it = ts.replicas.find(hash);
+        if (it != ts.replicas.end() && it->second.key == key)
+        {
+            Replica &r = it->second;
+            if (r.version == version(hash) && (r.expires_at == 0 || r.expires_at > unix_now_ms()))
+            {
+                r.reads++;
+                out = r.value;
+                ts.hits.store(ts.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return true;
+            }
+            ts.replicas.erase(it);
+            ts.invalidations.store(ts.invalidations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            ts.size.store(ts.replicas.size(), std::memory_order_relaxed);
+        }
+        ts.reads[hash]++;
+        return false;
+    }
+
+    // True if offer() would replicate the key now; lets a caller skip
+    // preparing a value that would not be used
+    bool wants(size_t hash)
+    {
+        ThreadState &ts = local();
+        auto count = ts.reads.find(hash);
+        return count != ts.reads.end() && count->second >= threshold_ && ts.replicas.size() < capacity_;
+    }
+
+    // A read of key was served by the shared cache with value; copy it into
+    // this thread's replicas if the key is hot. version is from version().
+    void offer(const std::string &key, size_t hash, uint64_t version, const SharedValue &value, int64_t expires_at)
+    {
+        ThreadState &ts = local();
+        auto count = ts.reads.find(hash);
+        if (count == ts.reads.end() || count->second < threshold_ || ts.replicas.size() >= capacity_)
+            return;
+        ts.reads.erase(count);
+        // A private copy: serving it must not touch the shared buffer's refcount
+        Replica r{key, std::make_shared<const std::string>(*value), version, expires_at, 0};
+        ts.replicas[hash] = std::move(r);
+        ts.promotions.store(ts.promotions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        ts.size.store(ts.replicas.size(), std::memory_order_relaxed);
+    }
+
+    Stats stats() const
+    {
+        Stats st;
+        std::lock_guard<std::mutex> lk(threads_mutex_);
+        for (const auto &ts : threads_)
+        {
+            st.hits += ts->hits.load(std::memory_order_relaxed);
+            st.promotions += ts->promotions.load(std::memory_order_relaxed);
+            st.invalidations += ts->invalidations.load(std::memory_order_relaxed);
+            st.replicas += static_cast<long long>(ts->size.load(std::memory_order_relaxed));
+        }
+        st.threads = static_cast<long long>(threads_.size());
+        return st;
+    }
+
+private:
+    static constexpr size_t kStripes = 4096;
+
+    struct Replica
+    {
+        std::string key;
+        SharedValue value;
+        uint64_t version;
+        int64_t expires_at;
+        size_t reads; // in the current window
+    };
+
+    // Written only by its thread; aligned so neighbours do not share a line
+    struct alignas(64) ThreadState
+    {
+        std::unordered_map<size_t, Replica> replicas; // by key hash
+        std::unordered_map<size_t, size_t> reads;     // reads of non-replicated keys this window
+        clock::time_point window_end;
+        std::atomic<long long> hits{0};
+        std::atomic<long long> promotions{0};
+        std::atomic<long long> invalidations{0};
+        std::atomic<size_t> size{0};
+    };
+
+    ThreadState &local()
+    {
+        thread_local ThreadState *ts = nullptr;
+        if (!ts)
+        {
+            std::unique_ptr<ThreadState> fresh(new ThreadState());
+            fresh->window_end = clock::now() + kWindow;
+            ts = fresh.get();
+            std::lock_guard<std::mutex> lk(threads_mutex_);
+            threads_.push_back(std::move(fresh));
+        }
+        return *ts;
+    }
+
+    // Start a new window: forget read counts, drop replicas that cooled off
+    void roll_window(ThreadState &ts)
+    {
+        clock::time_point now = clock::now();
+        if (now < ts.window_end)
+            return;
+        ts.window_end = now + kWindow;
+        ts.reads.clear();
+        for (auto it = ts.replicas.begin(); it != ts.replicas.end();)
+        {
+            if (it->second.reads < threshold_)
+            {
+                it = ts.replicas.erase(it);
+            }
+            else
+            {
+                it->second.reads = 0;
+                ++it;
+            }
+        }
+        ts.size.store(ts.replicas.size(), std::memory_order_relaxed);
+    }
+
+    size_t threshold_;
+    size_t capacity_;
+    std::atomic<uint64_t> stripes_[kStripes] = {};
+    mutable std::mutex threads_mutex_;
+    std::vector<std::unique_ptr<ThreadState>> threads_;
+};
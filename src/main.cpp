@@ -1,12 +1,19 @@
 #define CPPHTTPLIB_THREAD_POOL_COUNT 10
 
 #include "../lib/httplib.h"
+#include "sharded_cache.h"
+#include "negative_cache.h"
+#include "timer_wheel.h"
+#include "cache_snapshot.h"
+#include "hot_key_replicas.h"
+#include "single_flight.h"
+#include "value_codec.h"
+#include "slot_queue.h"
 #include <iostream>
 #include <fstream>
+#include <cstdio>
 #include <string>
 #include <map>
-#include <list>
-#include <unordered_map>
 #include <mutex>
 #include <condition_variable>
 #include <vector>
@@ -15,26 +22,62 @@
 #include <thread>
 #include <sstream>
 #include <stdexcept>
+#include <memory>
+#include <functional>
+#include <variant>
+#include <unordered_set>
+#include <deque>
+#include <csignal>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 #include <mysql_connection.h>
 #include <cppconn/driver.h>
 #include <cppconn/exception.h>
 #include <cppconn/statement.h>
 #include <cppconn/resultset.h>
+#include <cppconn/prepared_statement.h>
 
 // Use this namespace to avoid typing std:: often in examples
 using namespace std;
 
 // -------------------- Configuration & Globals --------------------
 size_t MAX_CACHE_SIZE ;
+size_t MAX_CACHE_BYTES = 0; // 0 = no byte budget, only MAX_CACHE_SIZE applies
+size_t MAX_ITEM_BYTES = 0;  // 0 = no per-item cap
+size_t SLAB_PAGE_BYTES = SlabAllocator::kDefaultPageBytes;
+double SLAB_GROWTH_FACTOR = SlabAllocator::kDefaultGrowthFactor;
+size_t SHARED_VALUE_BYTES = FlatCacheIndex::kDefaultSharedValueBytes;
+size_t NEGATIVE_CACHE_SIZE = 0;       // 0 = no tombstones
+long long NEGATIVE_CACHE_TTL_MS = 5000;
+size_t HOT_REPLICA_THRESHOLD = 0; // reads/s by one worker that replicate a key for /kv_popular; 0 = off
+size_t HOT_REPLICA_CAPACITY = 64; // replicated keys per worker thread
+long long CACHE_TTL_MS = 0;       // cached values are re-read from MySQL after this long; 0 = never
+int REFRESH_AHEAD_PERCENT = 0;    // hits in the last this-% of CACHE_TTL_MS refresh in the background; 0 = off
+long long STALE_SERVE_MS = 0;     // values past CACHE_TTL_MS are still served this long while refreshing
+size_t MEMORY_LIMIT_BYTES = 0;          // RSS the memory governor keeps the process under; 0 = off
+long long GOVERNOR_INTERVAL_MS = 1000;  // how often the governor checks RSS
+long long TTL_SWEEP_INTERVAL_MS = 1000; // how often expired rows are deleted from MySQL
+int TTL_DELETE_BATCH = 1000;            // rows per DELETE statement
+long long TOMBSTONE_TTL_MS = 60000;     // how long a deleted key's tombstone row is kept
+bool ttl_supported = false;             // kv_pairs has an expires_at column
+bool recency_supported = false;         // kv_pairs has updated_at
+bool flags_supported = false;           // kv_pairs has item_flags
+bool compression_supported = false;     // ... and item_value can hold compressed (binary) bytes
+bool version_supported = false;         // kv_pairs has version
+bool tombstones_supported = false;      // ... and expires_at, so deletes leave tombstone rows
+size_t COMPRESS_MIN_BYTES = 0;          // values this large are stored gzip-compressed; 0 = off
+int COMPRESS_LEVEL = Z_DEFAULT_COMPRESSION;
 int DB_POOL_SIZE ;
+long long DB_HEALTH_CHECK_MS = 1000; // how often idle pooled connections are pinged; 0 = never
 int SERVER_PORT ;
 
 std::atomic<long long> total_requests{0};
 std::atomic<long long> total_failures{0};
-std::atomic<long long> cache_hits{0};
-std::atomic<long long> cache_misses{0};
 std::atomic<long long> db_calls{0};
+std::atomic<long long> expired_db_rows{0};
 
 sql::Driver *driver_instance = nullptr;
 
@@ -81,88 +124,395 @@ map<string, string> read_config(const string &filename)
     return config;
 }
 
-// -------------------- LRU Cache (thread-safe via cache_mutex) --------------------
-list<pair<string, string>> lru_list; // front = oldest, back = newest
-unordered_map<string, list<pair<string, string>>::iterator> cache_map;
-std::mutex cache_mutex;
+// -------------------- Cache --------------------
+// The cache itself lives in sharded_cache.h. Its eviction policy (CACHE_POLICY)
+// and locking policy (CACHE_LOCKING) are template parameters; main() builds
+// the chosen instantiation once, and with_cache() reaches it through a
+// std::variant, i.e. one predictable branch per call instead of a virtual
+// dispatch.
+size_t CACHE_SHARDS = 1;
 
-void move_to_back(const string &key)
+enum class EvictionPolicy
 {
-    auto it = cache_map.find(key);
-    if (it != cache_map.end())
-    {
-        lru_list.splice(lru_list.end(), lru_list, it->second);
-    }
+    LRU,
+    CLOCK,
+    TWO_Q,
+    ARC,
+    S3_FIFO,
+    GDSF
+};
+EvictionPolicy CACHE_POLICY = EvictionPolicy::LRU;
+
+enum class LockingPolicy
+{
+    RWLOCK,
+    MUTEX,
+    RCU
+};
+LockingPolicy CACHE_LOCKING = LockingPolicy::RWLOCK;
+
+enum class AdmissionPolicy
+{
+    NONE,
+    TINYLFU
+};
+AdmissionPolicy CACHE_ADMISSION = AdmissionPolicy::NONE;
+
+using AnyCache = std::variant<unique_ptr<ShardedCache<LruPolicy, RwLocking>>,
+                              unique_ptr<ShardedCache<LruPolicy, MutexLocking>>,
+                              unique_ptr<ShardedCache<LruPolicy, RcuLocking>>,
+                              unique_ptr<ShardedCache<ClockPolicy, RwLocking>>,
+                              unique_ptr<ShardedCache<ClockPolicy, MutexLocking>>,
+                              unique_ptr<ShardedCache<ClockPolicy, RcuLocking>>,
+                              unique_ptr<ShardedCache<TwoQueuePolicy, RwLocking>>,
+                              unique_ptr<ShardedCache<TwoQueuePolicy, MutexLocking>>,
+                              unique_ptr<ShardedCache<TwoQueuePolicy, RcuLocking>>,
+                              unique_ptr<ShardedCache<ArcPolicy, RwLocking>>,
+                              unique_ptr<ShardedCache<ArcPolicy, MutexLocking>>,
+                              unique_ptr<ShardedCache<ArcPolicy, RcuLocking>>,
+                              unique_ptr<ShardedCache<S3FifoPolicy, RwLocking>>,
+                              unique_ptr<ShardedCache<S3FifoPolicy, MutexLocking>>,
+                              unique_ptr<ShardedCache<S3FifoPolicy, RcuLocking>>,
+                              unique_ptr<ShardedCache<GdsfPolicy, RwLocking>>,
+                              unique_ptr<ShardedCache<GdsfPolicy, MutexLocking>>,
+                              unique_ptr<ShardedCache<GdsfPolicy, RcuLocking>>>;
+AnyCache cache_instance;
+
+template <typename F>
+decltype(auto) with_cache(F &&f)
+{
+    return std::visit([&](auto &cache) -> decltype(auto)
+                      { return f(*cache); },
+                      cache_instance);
+}
+
+template <typename Eviction>
+void create_cache(const CacheConfig &config)
+{
+    if (CACHE_LOCKING == LockingPolicy::MUTEX)
+        cache_instance = make_unique<ShardedCache<Eviction, MutexLocking>>(config);
+    else if (CACHE_LOCKING == LockingPolicy::RCU)
+        cache_instance = make_unique<ShardedCache<Eviction, RcuLocking>>(config);
+    else
+        cache_instance = make_unique<ShardedCache<Eviction, RwLocking>>(config);
+}
+
+// Largest byte budget the cache may have: MAX_CACHE_BYTES, and with a memory
+// governor never more than MEMORY_LIMIT_BYTES (0 = none)
+size_t cache_byte_ceiling()
+{
+    if (MEMORY_LIMIT_BYTES == 0)
+        return MAX_CACHE_BYTES;
+    return MAX_CACHE_BYTES > 0 ? min(MAX_CACHE_BYTES, MEMORY_LIMIT_BYTES) : MEMORY_LIMIT_BYTES;
 }
 
-void add_to_cache(const string &key, const string &value)
+void init_cache()
 {
-    if (cache_map.size() >= MAX_CACHE_SIZE)
+    CacheConfig config;
+    config.max_items = MAX_CACHE_SIZE;
+    config.max_bytes = cache_byte_ceiling();
+    config.max_item_bytes = MAX_ITEM_BYTES;
+    config.shards = CACHE_SHARDS;
+    config.tinylfu = CACHE_ADMISSION == AdmissionPolicy::TINYLFU;
+    config.log_events = true;
+    config.slab_page_bytes = SLAB_PAGE_BYTES;
+    config.slab_growth_factor = SLAB_GROWTH_FACTOR;
+    config.shared_value_bytes = SHARED_VALUE_BYTES;
+    config.max_age_ms = CACHE_TTL_MS > 0 ? CACHE_TTL_MS + STALE_SERVE_MS : 0;
+
+    switch (CACHE_POLICY)
     {
-        string lru_key = lru_list.front().first;
-        lru_list.pop_front();
-        cache_map.erase(lru_key);
-        cout << "[CACHE EVICT] Evicted key: " << lru_key << endl;
+    case EvictionPolicy::LRU:
+        create_cache<LruPolicy>(config);
+        break;
+    case EvictionPolicy::CLOCK:
+        create_cache<ClockPolicy>(config);
+        break;
+    case EvictionPolicy::TWO_Q:
+        create_cache<TwoQueuePolicy>(config);
+        break;
+    case EvictionPolicy::ARC:
+        create_cache<ArcPolicy>(config);
+        break;
+    case EvictionPolicy::S3_FIFO:
+        create_cache<S3FifoPolicy>(config);
+        break;
+    case EvictionPolicy::GDSF:
+        create_cache<GdsfPolicy>(config);
+        break;
     }
-    lru_list.push_back({key, value});
-    cache_map[key] = --lru_list.end();
-    cout << "[CACHE] Stored key: " << key << endl;
+    CACHE_SHARDS = with_cache([](auto &cache)
+                              { return cache.shard_count(); });
+}
+
+EvictionPolicy parse_eviction_policy(const string &name)
+{
+    if (name == "lru")
+        return EvictionPolicy::LRU;
+    if (name == "clock")
+        return EvictionPolicy::CLOCK;
+    if (name == "2q")
+        return EvictionPolicy::TWO_Q;
+    if (name == "arc")
+        return EvictionPolicy::ARC;
+    if (name == "s3fifo")
+        return EvictionPolicy::S3_FIFO;
+    if (name == "gdsf")
+        return EvictionPolicy::GDSF;
+    throw runtime_error("Unknown CACHE_POLICY '" + name + "' (expected lru, clock, 2q, arc, s3fifo or gdsf)");
+}
+
+bool cache_get(const string &key, SharedValue &out_value, EntryInfo *info = nullptr)
+{
+    return with_cache([&](auto &cache)
+                      { return cache.get(key, out_value, info); });
+}
+
+// count_access=false when the put only fills a miss that cache_get already recorded.
+// expires_at is a unix-ms deadline, 0 = never.
+// Value is a string (copied into the cache) or a SharedValue (a large value
+// keeps the caller's buffer). flags is the value's encoding (value_codec.h).
+// version is the write's (next_version()); an older write than one the cache
+// has already seen for the key is dropped.
+// cost_us is what fetching the value from MySQL costs (0 = unknown).
+template <typename Value>
+void cache_put(const string &key, const Value &value, bool count_access = true, int64_t expires_at = 0,
+               uint8_t flags = 0, uint64_t version = 0, uint32_t cost_us = 0)
+{
+    with_cache([&](auto &cache)
+               { cache.put(key, value, count_access, expires_at, flags, version, cost_us); });
+}
+
+void cache_delete(const string &key, uint64_t version = 0)
+{
+    with_cache([&](auto &cache)
+               { cache.erase(key, version); });
+}
+
+// Tombstones for keys known to be absent (see negative_cache.h)
+unique_ptr<NegativeCache> negative_cache;
+
+// Per-worker copies of the hottest /kv_popular keys (see hot_key_replicas.h)
+unique_ptr<HotKeyReplicas> hot_replicas;
+
+// -------------------- Connection Pool --------------------
+// The request path's three statements, prepared on a connection once and
+// reused for every request on it. They are prepared on the connection's
+// first use after startup (the schema checks decide their column lists) and
+// again after the pool reconnects the connection. Keys and values are bound as
+// parameters, so nothing is escaped and values are binary-safe.
+struct KvStatements
+{
+    unique_ptr<sql::PreparedStatement> upsert; // item_key, item_value[, expires_at][, item_flags][, version]
+    unique_ptr<sql::PreparedStatement> select; // item_key[, now ms]
+    unique_ptr<sql::PreparedStatement> remove; // item_key[, version]
+
+    // Group commit: one statement per batch size, prepared on first use
+    map<size_t, unique_ptr<sql::PreparedStatement>> batch_upserts; // the upsert's parameters per row
+    map<size_t, unique_ptr<sql::PreparedStatement>> batch_locks;   // item_key per row
+    map<size_t, unique_ptr<sql::PreparedStatement>> batch_removes; // item_key per row
+    map<size_t, unique_ptr<sql::PreparedStatement>> batch_selects; // select_sql(n)'s parameters
+};
+
+// "?, ?, ..." with n placeholders
+string sql_placeholders(size_t n)
+{
+    string out;
+    for (size_t i = 0; i < n; ++i)
+        out += i ? ", ?" : "?";
+    return out;
 }
 
-bool cache_get(const string &key, string &out_value)
+// INSERT ... ON DUPLICATE KEY UPDATE of rows rows; bind each with bind_upsert_row
+string upsert_sql(size_t rows)
 {
-    std::lock_guard<std::mutex> lk(cache_mutex);
-    auto it = cache_map.find(key);
-    if (it != cache_map.end())
+    string columns = "item_key, item_value";
+    string params = "?, ?";
+    // With versions each column changes only if the write is newer, and
+    // version itself must be assigned last
+    auto update = [](const string &column)
     {
-        out_value = it->second->second;
-        move_to_back(key);
-        cache_hits++;
-        return true;
+        return version_supported ? column + "=IF(version < VALUES(version), VALUES(" + column + "), " + column + ")"
+                                 : column + "=VALUES(" + column + ")";
+    };
+    string updates = update("item_value");
+    if (ttl_supported)
+    {
+        columns += ", expires_at";
+        params += ", ?";
+        updates += ", " + update("expires_at");
     }
-    cache_misses++;
-    return false;
+    if (flags_supported)
+    {
+        columns += ", item_flags";
+        params += ", ?";
+        updates += ", " + update("item_flags");
+    }
+    if (version_supported)
+    {
+        columns += ", version";
+        params += ", ?";
+        updates += ", version=GREATEST(version, VALUES(version))";
+    }
+    string values;
+    for (size_t i = 0; i < rows; ++i)
+        values += (i ? ", (" : "(") + params + ")";
+    return "INSERT INTO kv_pairs(" + columns + ") VALUES" + values + " ON DUPLICATE KEY UPDATE " + updates;
 }
 
-void cache_put(const string &key, const string &value)
+// Bind one row of upsert_sql starting at param. stored is bound as a blob
+// (compressed bytes are binary) read from blob, which must outlive the execute.
+void bind_upsert_row(sql::PreparedStatement &stmt, unsigned &param, const string &key, istream &blob, uint8_t flags,
+                     int64_t expires_at, uint64_t version)
 {
-    std::lock_guard<std::mutex> lk(cache_mutex);
-    auto it = cache_map.find(key);
-    if (it != cache_map.end())
+    stmt.setString(param++, key);
+    stmt.setBlob(param++, &blob);
+    if (ttl_supported)
     {
-        it->second->second = value;
-        move_to_back(key);
+        if (expires_at > 0)
+            stmt.setInt64(param++, expires_at);
+        else
+            stmt.setNull(param++, sql::DataType::BIGINT);
     }
+    if (flags_supported)
+        stmt.setInt(param++, flags);
+    if (version_supported)
+        stmt.setUInt64(param++, version);
+}
+
+// statements[rows], prepared from make_sql(rows) the first time
+template <typename MakeSql>
+sql::PreparedStatement &batch_statement(sql::Connection *con, map<size_t, unique_ptr<sql::PreparedStatement>> &statements,
+                                        size_t rows, MakeSql make_sql)
+{
+    unique_ptr<sql::PreparedStatement> &stmt = statements[rows];
+    if (!stmt)
+        stmt.reset(con->prepareStatement(make_sql(rows)));
+    return *stmt;
+}
+
+// SELECT of the live rows of keys keys: item_key × keys[, now ms]. Read each
+// row with read_columns. With several keys each row's item_key is the key
+// as asked for, not as stored: the keys are joined in as a derived table, so
+// a collation that matches keys loosely (case, trailing spaces) still hands
+// every row back to the request that wanted it.
+string select_sql(size_t keys)
+{
+    string query = keys == 1 ? "SELECT v.item_key" : "SELECT k.item_key";
+    query += ", v.item_value";
+    if (ttl_supported)
+        query += ", COALESCE(v.expires_at, 0) AS expires_at";
+    if (flags_supported)
+        query += ", v.item_flags";
+    if (version_supported)
+        query += ", v.version";
+    if (keys == 1)
+        query += " FROM kv_pairs v WHERE v.item_key = ?";
     else
     {
-        add_to_cache(key, value);
+        query += " FROM (SELECT ? AS item_key";
+        for (size_t i = 1; i < keys; ++i)
+            query += " UNION ALL SELECT ?";
+        query += ") k JOIN kv_pairs v ON v.item_key = k.item_key WHERE TRUE";
     }
+    // Rows past their deadline are treated as gone even before the sweeper deletes them
+    if (ttl_supported)
+        query += " AND (v.expires_at IS NULL OR v.expires_at > ?)";
+    return query;
 }
 
-void cache_delete(const string &key)
+void read_columns(sql::ResultSet &res, string &value, int64_t &expires_at, uint8_t &flags, uint64_t &version)
 {
-    std::lock_guard<std::mutex> lk(cache_mutex);
-    auto it = cache_map.find(key);
-    if (it != cache_map.end())
-    {
-        lru_list.erase(it->second);
-        cache_map.erase(it);
-        cout << "[CACHE] Deleted key: " << key << endl;
-    }
+    value = res.getString("item_value");
+    if (ttl_supported)
+        expires_at = res.getInt64("expires_at");
+    if (flags_supported)
+        flags = static_cast<uint8_t>(res.getInt("item_flags"));
+    if (version_supported)
+        version = static_cast<uint64_t>(res.getInt64("version"));
 }
 
-// -------------------- Connection Pool --------------------
+unique_ptr<KvStatements> prepare_kv_statements(sql::Connection *con)
+{
+    unique_ptr<KvStatements> stmts(new KvStatements());
+    stmts->upsert.reset(con->prepareStatement(upsert_sql(1)));
+    stmts->select.reset(con->prepareStatement(select_sql(1)));
+
+    // A newer write that got to MySQL first stays. With tombstones the live
+    // row becomes one (see delete_row_now) instead of going away.
+    string remove = "DELETE FROM kv_pairs WHERE item_key = ?";
+    if (tombstones_supported)
+        remove = string("UPDATE kv_pairs SET item_value = '', expires_at = ?") + (flags_supported ? ", item_flags = 0" : "") +
+                 ", version = ? WHERE item_key = ? AND version < ? AND (expires_at IS NULL OR expires_at > ?)";
+    else if (version_supported)
+        remove += " AND version < ?";
+    stmts->remove.reset(con->prepareStatement(remove));
+    return stmts;
+}
+
+// Connections are handed out through a lock-free FIFO of slot indices
+// (slot_queue.h), so acquire and release are O(1) and take no lock unless the
+// pool is empty. Each slot keeps its connection object for the pool's
+// lifetime (a dead session is reconnected in place), so the map from
+// connection to slot is fixed at init and read without a lock.
+//
+// Requests never pay for a liveness check. A health thread wakes every
+// DB_HEALTH_CHECK_MS and takes each idle connection out of the queue in
+// turn, pings it and puts it back. A connection that fails the ping is
+// reconnected; one that cannot be reconnected stays out of the queue and is
+// retried on the next pass.
 class ConnectionPool
 {
 private:
     vector<sql::Connection *> pool;
-    vector<bool> in_use;
-    mutex pool_mutex;
-    condition_variable pool_cv;
+    vector<unique_ptr<KvStatements>> statements; // per connection, prepared on first use
+    unordered_map<sql::Connection *, uint32_t> slot_of; // fixed after init
+    unique_ptr<SlotQueue> idle;
 
     string host, user, pass, schema;
 
+    thread health_thread;
+    mutex health_mutex;
+    condition_variable health_cv;
+    bool stopping = false;
+
+    // Ping a connection the caller holds, reconnecting it if it is dead.
+    // Returns false if it is still unusable.
+    bool check(uint32_t slot)
+    {
+        sql::Connection *con = pool[slot];
+        try
+        {
+            if (con->isValid()) // may throw
+                return true;
+        }
+        catch (const exception &)
+        {
+        }
+        // Statements die with their session
+        statements[slot].reset();
+        reconnects++;
+        try
+        {
+            if (con->reconnect())
+            {
+                con->setSchema(schema);
+                return true;
+            }
+            cerr << "[POOL] Reconnect of connection " << slot << " failed" << endl;
+        }
+        catch (const sql::SQLException &e)
+        {
+            cerr << "[POOL] Reconnect of connection " << slot << " failed: " << e.what() << endl;
+        }
+        return false;
+    }
+
 public:
+    atomic<long long> checks{0};
+    atomic<long long> reconnects{0};
+    atomic<long long> dead{0}; // connections out of the queue until they reconnect
+
     ConnectionPool() = default;
 
     // Initialize pool with given size
@@ -179,9 +529,9 @@ public:
         }
 
         pool.clear();
-        in_use.clear();
+        statements.clear();
+        slot_of.clear();
         pool.reserve(pool_size);
-        in_use.reserve(pool_size);
 
         for (int i = 0; i < pool_size; ++i)
         {
@@ -189,8 +539,9 @@ public:
             {
                 sql::Connection *con = driver_instance->connect(host, user, pass);
                 con->setSchema(schema);
+                slot_of[con] = static_cast<uint32_t>(pool.size());
                 pool.push_back(con);
-                in_use.push_back(false);
+                statements.emplace_back();
                 cout << "[POOL] Created connection " << i << endl;
             }
             catch (const sql::SQLException &e)
@@ -204,91 +555,95 @@ public:
         {
             throw runtime_error("ConnectionPool: Could not create any DB connections");
         }
+        idle.reset(new SlotQueue(pool.size()));
+        for (uint32_t i = 0; i < pool.size(); ++i)
+            idle->push(i);
     }
 
-    // Acquire a free connection (blocking)
-    sql::Connection *acquire()
+    // Start the health thread; interval_ms <= 0 = never check
+    void start_health_checks(long long interval_ms)
     {
-        unique_lock<mutex> lk(pool_mutex);
-        pool_cv.wait(lk, [&]()
-                     {
-            for (size_t i = 0; i < pool.size(); ++i)
-            {
-                if (!in_use[i])
-                    return true;
-            }
-            return false; });
+        if (interval_ms > 0)
+            health_thread = thread(&ConnectionPool::health_loop, this, interval_ms);
+    }
 
-        // find first free
-        for (size_t i = 0; i < pool.size(); ++i)
+    void health_loop(long long interval_ms)
+    {
+        vector<uint32_t> broken;
+        unique_lock<mutex> lk(health_mutex);
+        while (!health_cv.wait_for(lk, chrono::milliseconds(interval_ms), [&]()
+                                   { return stopping; }))
         {
-            if (!in_use[i])
+            lk.unlock();
+            // The queue is FIFO: taking as many connections as are idle and
+            // putting each back visits each of them once
+            size_t n = idle->size();
+            for (size_t i = 0; i < n; ++i)
             {
-                in_use[i] = true;
-                sql::Connection *c = pool[i];
-
-                // Simple liveness check; try to reconnect if invalid
-                try
-                {
-                    if (!c->isValid()) // may throw
-                    {
-                        // attempt reconnect
-                        try
-                        {
-                            delete c;
-                        }
-                        catch (...)
-                        {
-                        }
-                        try
-                        {
-                            c = driver_instance->connect(host, user, pass);
-                            c->setSchema(schema);
-                            pool[i] = c;
-                        }
-                        catch (const sql::SQLException &e)
-                        {
-                            cerr << "[POOL] Reconnect failed: " << e.what() << endl;
-                            // leave connection pointer null, but still mark in_use true temporarily
-                        }
-                    }
-                }
-                catch (const exception &e)
+                uint32_t slot;
+                if (!idle->try_pop(slot))
+                    break;
+                checks++;
+                if (check(slot))
+                    idle->push(slot);
+                else
+                    broken.push_back(slot);
+            }
+            // Retry the ones that could not reconnect
+            for (auto it = broken.begin(); it != broken.end();)
+            {
+                if (check(*it))
                 {
-                    // Some connectors may throw on isValid; attempt a reconnect
-                    try
-                    {
-                        delete c;
-                        c = driver_instance->connect(host, user, pass);
-                        c->setSchema(schema);
-                        pool[i] = c;
-                    }
-                    catch (const sql::SQLException &se)
-                    {
-                        cerr << "[POOL] Reconnect exception: " << se.what() << endl;
-                    }
+                    idle->push(*it);
+                    it = broken.erase(it);
                 }
-
-                return pool[i];
+                else
+                    ++it;
             }
+            dead = static_cast<long long>(broken.size());
+            lk.lock();
         }
+        for (uint32_t slot : broken)
+            idle->push(slot);
+    }
+
+    // A new connection outside the pool for a thread that keeps its own;
+    // the caller deletes it. May throw.
+    sql::Connection *connect_dedicated()
+    {
+        sql::Connection *con = driver_instance->connect(host, user, pass);
+        con->setSchema(schema);
+        return con;
+    }
+
+    // Acquire a free connection (blocking)
+    sql::Connection *acquire()
+    {
+        return pool[idle->pop()];
+    }
 
-        // Shouldn't reach here
-        return nullptr;
+    // The prepared statements of a connection the caller has acquired,
+    // preparing them if needed. May throw.
+    KvStatements &kv_statements(sql::Connection *con)
+    {
+        auto it = slot_of.find(con);
+        if (it == slot_of.end())
+            throw runtime_error("ConnectionPool: connection is not pooled");
+        // Only the holder of the connection touches its slot
+        unique_ptr<KvStatements> &stmts = statements[it->second];
+        if (!stmts)
+            stmts = prepare_kv_statements(con);
+        return *stmts;
     }
 
     // Release the previously acquired connection back to the pool
     void release(sql::Connection *con)
     {
-        unique_lock<mutex> lk(pool_mutex);
-        for (size_t i = 0; i < pool.size(); ++i)
+        auto it = slot_of.find(con);
+        if (it != slot_of.end())
         {
-            if (pool[i] == con)
-            {
-                in_use[i] = false;
-                pool_cv.notify_one();
-                return;
-            }
+            idle->push(it->second);
+            return;
         }
 
         // If not found in pool (rare), just delete and ignore
@@ -301,227 +656,2055 @@ public:
         }
     }
 
-    // Cleanup
+    size_t size() const { return pool.size(); }
+    size_t idle_count() const { return idle ? idle->size() : 0; }
+    int waiting() const { return idle ? idle->waiters() : 0; }
+
+    // Cleanup; no connection may be in use
     void cleanup()
     {
-        unique_lock<mutex> lk(pool_mutex);
+        {
+            lock_guard<mutex> lk(health_mutex);
+            stopping = true;
+        }
+        health_cv.notify_all();
+        if (health_thread.joinable())
+            health_thread.join();
+        statements.clear();
         for (auto c : pool)
         {
-            try
+            try
+            {
+                delete c;
+            }
+            catch (...)
+            {
+            }
+        }
+        pool.clear();
+        slot_of.clear();
+        idle.reset();
+    }
+
+    ~ConnectionPool()
+    {
+        cleanup();
+    }
+};
+
+ConnectionPool db_pool;
+
+// -------------------- Background threads --------------------
+// Every background thread is started with start_background() and sleeps
+// through stop_wait(), so shutdown can wake and join them all before the
+// final snapshot is written and the pool and the cache are torn down.
+// Threads blocked on a queue of their own also wake for shutting_down.
+atomic<bool> shutting_down{false};
+mutex stop_mutex;
+condition_variable stop_cv;
+vector<thread> background_threads;
+
+template <typename F>
+void start_background(F &&f)
+{
+    background_threads.emplace_back(std::forward<F>(f));
+}
+
+// Sleep for d; returns false (at once) when shutdown has begun
+template <typename Duration>
+bool stop_wait(Duration d)
+{
+    unique_lock<mutex> lk(stop_mutex);
+    return !stop_cv.wait_for(lk, d, []()
+                             { return shutting_down.load(); });
+}
+
+// -------------------- Snapshot --------------------
+// The cache is written to SNAPSHOT_FILE (format in cache_snapshot.h) every
+// SNAPSHOT_INTERVAL_S and on graceful shutdown (SIGINT/SIGTERM). At startup
+// the file is mapped and a background thread loads its records into the
+// cache in eviction order; until it finishes, a cache miss looks the key up in
+// the mapped file before going to MySQL, so the server answers warm hits as
+// soon as it listens.
+//
+// A snapshot entry is never installed for a key that was written or deleted
+// through this process since startup (the dirty set), nor for a key whose
+// row changed after the snapshot was taken (found through
+// kv_pairs.updated_at before serving starts). Rows deleted from MySQL by
+// someone else while the server was down cannot be detected;
+// SNAPSHOT_MAX_AGE_S bounds how old such entries can be.
+string SNAPSHOT_FILE;                // empty = no snapshots
+long long SNAPSHOT_INTERVAL_S = 300; // 0 = only on shutdown
+long long SNAPSHOT_MAX_AGE_S = 3600; // older snapshots are ignored; 0 = any age
+// MySQL's clock and ours may disagree a little; rows updated this long
+// before the snapshot was taken are treated as changed too
+const int64_t SNAPSHOT_CLOCK_SLACK_MS = 5000;
+
+struct SnapshotProgress
+{
+    atomic<bool> restoring{false};
+    atomic<long long> records{0};  // records in the snapshot being restored
+    atomic<long long> restored{0}; // records loaded by the restore thread
+    atomic<long long> lazy_hits{0};
+    atomic<long long> changed{0}; // keys skipped because MySQL has newer rows
+    atomic<long long> corrupt{0};
+    atomic<long long> started_ms{0};
+    atomic<long long> finished_ms{0};
+    atomic<long long> last_records{0}; // last snapshot written
+    atomic<long long> last_bytes{0};
+    atomic<long long> last_written_ms{0};
+    atomic<long long> last_write_duration_ms{0};
+};
+SnapshotProgress snapshot;
+
+// Mapped snapshot, set only while a restore is running (atomic_load/store)
+shared_ptr<SnapshotReader> snapshot_source;
+mutex snapshot_dirty_mutex;
+unordered_set<string> snapshot_dirty; // keys the snapshot must not install
+mutex snapshot_write_mutex;
+
+// Called before a key is written or deleted so a restore still in progress
+// cannot put the old value back
+void snapshot_mark_dirty(const string &key)
+{
+    if (!atomic_load(&snapshot_source))
+        return;
+    lock_guard<mutex> lk(snapshot_dirty_mutex);
+    snapshot_dirty.insert(key);
+}
+
+// Fill the cache from a snapshot record unless the key is dirty. Returns
+// false if the record must not be used.
+bool snapshot_install(const SnapshotRecord &rec)
+{
+    string key(rec.key);
+    lock_guard<mutex> lk(snapshot_dirty_mutex);
+    if (snapshot_dirty.count(key))
+        return false;
+    with_cache([&](auto &cache)
+               { cache.fill(key, rec.value, rec.expires_at, static_cast<uint8_t>(rec.flags)); });
+    return true;
+}
+
+// Cache miss during a restore: serve the key from the mapped file
+StoredValue snapshot_lookup(const string &key)
+{
+    shared_ptr<SnapshotReader> source = atomic_load(&snapshot_source);
+    SnapshotRecord rec;
+    if (!source || !source->find(key, rec))
+        return {};
+    if ((rec.expires_at > 0 && rec.expires_at <= unix_now_ms()) || rec.value.empty() || !snapshot_install(rec))
+        return {};
+    snapshot.lazy_hits++;
+    return {make_shared<const string>(rec.value), static_cast<uint8_t>(rec.flags)};
+}
+
+// Mark every key whose row changed since created_ms as dirty. Returns false
+// if MySQL could not be asked.
+bool snapshot_reconcile(int64_t created_ms)
+{
+    sql::Connection *con = db_pool.acquire();
+    if (!con)
+        return false;
+    bool ok = true;
+    try
+    {
+        unique_ptr<sql::Statement> stmt(con->createStatement());
+        stmt->setResultSetType(sql::ResultSet::TYPE_FORWARD_ONLY);
+        db_calls++;
+        int64_t since = created_ms - SNAPSHOT_CLOCK_SLACK_MS;
+        unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+            "SELECT item_key FROM kv_pairs WHERE updated_at >= FROM_UNIXTIME(" + to_string(since / 1000) + "." +
+            to_string(1000 + since % 1000).substr(1) + ")"));
+        lock_guard<mutex> lk(snapshot_dirty_mutex);
+        while (res->next())
+            snapshot_dirty.insert(res->getString("item_key"));
+    }
+    catch (const sql::SQLException &e)
+    {
+        cerr << "DATABASE ERROR (snapshot): " << e.what() << endl;
+        ok = false;
+    }
+    db_pool.release(con);
+    return ok;
+}
+
+// Map SNAPSHOT_FILE and make it the restore source. Returns false if there
+// is no usable snapshot; the caller then warms up from MySQL as usual.
+bool open_snapshot()
+{
+    string error;
+    shared_ptr<SnapshotReader> source(SnapshotReader::open(SNAPSHOT_FILE, unix_now_ms(), SNAPSHOT_MAX_AGE_S * 1000, error));
+    if (!source)
+    {
+        cout << "[SNAPSHOT] Not restoring " << SNAPSHOT_FILE << ": " << error << endl;
+        return false;
+    }
+    if (!recency_supported || !snapshot_reconcile(source->created_ms()))
+    {
+        cerr << "[SNAPSHOT] Cannot tell which rows changed since " << SNAPSHOT_FILE << " was written, not restoring" << endl;
+        return false;
+    }
+    snapshot.records = static_cast<long long>(source->record_count());
+    snapshot.started_ms = unix_now_ms();
+    snapshot.restoring = true;
+    cout << "[SNAPSHOT] Restoring " << source->record_count() << " entries from " << SNAPSHOT_FILE << " ("
+         << (source->clean() ? "clean shutdown" : "periodic") << ", " << (unix_now_ms() - source->created_ms()) / 1000
+         << " s old, " << snapshot_dirty.size() << " rows changed since)" << endl;
+    atomic_store(&snapshot_source, source);
+    return true;
+}
+
+// Load every record of the open snapshot into the cache, then drop it
+void restore_snapshot()
+{
+    shared_ptr<SnapshotReader> source = atomic_load(&snapshot_source);
+    int64_t now = unix_now_ms();
+    for (uint64_t offset : source->record_offsets())
+    {
+        // Still restoring, so the final snapshot keeps the existing file
+        if (shutting_down)
+            return;
+        SnapshotRecord rec;
+        if (!source->read(offset, rec))
+        {
+            snapshot.corrupt++;
+            continue;
+        }
+        if ((rec.expires_at > 0 && rec.expires_at <= now) || rec.value.empty())
+            continue;
+        if (snapshot_install(rec))
+            snapshot.restored++;
+        else
+            snapshot.changed++;
+    }
+
+    atomic_store(&snapshot_source, shared_ptr<SnapshotReader>());
+    {
+        lock_guard<mutex> lk(snapshot_dirty_mutex);
+        snapshot_dirty.clear();
+    }
+    snapshot.finished_ms = unix_now_ms();
+    snapshot.restoring = false;
+    cout << "[SNAPSHOT] Restored " << snapshot.restored.load() << " entries in "
+         << snapshot.finished_ms - snapshot.started_ms << " ms (" << snapshot.changed.load() << " changed, "
+         << snapshot.corrupt.load() << " corrupt)" << endl;
+}
+
+// Write the cache to SNAPSHOT_FILE. clean = no more writes will follow.
+// Skipped while a restore is running, since the cache is not complete yet
+// and the existing file is still the better copy.
+void write_snapshot(bool clean)
+{
+    lock_guard<mutex> lk(snapshot_write_mutex);
+    if (snapshot.restoring)
+    {
+        cout << "[SNAPSHOT] Restore still running, keeping the existing snapshot" << endl;
+        return;
+    }
+    // Taken before the walk starts: a key changed during the walk has a newer
+    // updated_at and is reconciled on the next restore
+    int64_t created_ms = unix_now_ms();
+    SnapshotWriter writer(SNAPSHOT_FILE);
+    with_cache([&](auto &cache)
+               { cache.for_each_entry([&](string_view key, string_view value, int64_t expires_at, uint8_t flags)
+                                      { writer.add(key, value, expires_at, flags); }); });
+    uint64_t records = writer.records();
+    uint64_t bytes = writer.bytes();
+    if (!writer.commit(created_ms, clean))
+    {
+        cerr << "[SNAPSHOT] Cannot write " << SNAPSHOT_FILE << endl;
+        return;
+    }
+    snapshot.last_records = static_cast<long long>(records);
+    snapshot.last_bytes = static_cast<long long>(bytes);
+    snapshot.last_written_ms = unix_now_ms();
+    snapshot.last_write_duration_ms = snapshot.last_written_ms - created_ms;
+    cout << "[SNAPSHOT] Wrote " << records << " entries to " << SNAPSHOT_FILE << " in "
+         << snapshot.last_write_duration_ms.load() << " ms" << endl;
+}
+
+void snapshot_loop()
+{
+    while (stop_wait(chrono::seconds(SNAPSHOT_INTERVAL_S)))
+        write_snapshot(false);
+}
+
+// -------------------- Miss cost --------------------
+// Every miss SELECT is timed. The entry it fills is charged that latency as
+// its fetch cost; a value written by POST was never fetched and is charged
+// the running average. CACHE_POLICY=gdsf evicts by cost, size and frequency,
+// and with any policy a hit adds its entry's cost to the estimate of MySQL
+// time the cache saved.
+struct MissCost
+{
+    atomic<long long> selects{0};
+    atomic<long long> select_us{0}; // total time of miss SELECTs
+    atomic<long long> saved_us{0};  // fetch cost of every hit
+    atomic<uint32_t> average_us{0}; // moving average of miss SELECT latency
+};
+MissCost miss_cost;
+
+// Microseconds since start, for charging an entry its fetch cost
+uint32_t elapsed_us(chrono::steady_clock::time_point start)
+{
+    long long us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    return static_cast<uint32_t>(min<long long>(max<long long>(us, 1), UINT32_MAX));
+}
+
+void record_select_latency(uint32_t us)
+{
+    miss_cost.selects++;
+    miss_cost.select_us += us;
+    // 1/8 weight for the newest sample; a lost update under a race is harmless
+    uint32_t average = miss_cost.average_us.load(memory_order_relaxed);
+    miss_cost.average_us.store(average == 0 ? us : average - average / 8 + us / 8, memory_order_relaxed);
+}
+
+void record_hit_saving(const EntryInfo &info)
+{
+    miss_cost.saved_us += info.cost_us > 0 ? info.cost_us : miss_cost.average_us.load(memory_order_relaxed);
+}
+
+// -------------------- Database operations (use pool) --------------------
+
+// Misses in flight, so a burst of GETs for one uncached key waits for a
+// single SELECT instead of taking one pooled connection each
+bool COALESCE_MISSES = true;
+SingleFlight<pair<int, StoredValue>> miss_flights;
+
+struct CompressionProgress
+{
+    atomic<long long> compressed{0};     // values stored compressed
+    atomic<long long> incompressible{0}; // large enough but did not shrink
+    atomic<long long> saved_bytes{0};
+    atomic<long long> gzip_responses{0};     // sent compressed as they were stored
+    atomic<long long> inflated_responses{0}; // inflated for a client without gzip
+    atomic<long long> corrupt{0};
+};
+CompressionProgress compression;
+
+// Compress value into stored if compression is on, the value is at least
+// COMPRESS_MIN_BYTES and it shrinks by at least an eighth. Returns the flags
+// to store with it (0 = store value as it is).
+uint8_t encode_value(const string &value, string &stored)
+{
+    if (!compression_supported || COMPRESS_MIN_BYTES == 0 || value.size() < COMPRESS_MIN_BYTES)
+        return 0;
+    if (!gzip_compress(value, stored, COMPRESS_LEVEL) || stored.size() > value.size() - value.size() / 8)
+    {
+        compression.incompressible++;
+        return 0;
+    }
+    compression.compressed++;
+    compression.saved_bytes += static_cast<long long>(value.size() - stored.size());
+    return kValueGzip;
+}
+
+// -------------------- Write versions --------------------
+// Every write and delete takes a version: microseconds since the epoch,
+// forced strictly increasing, so a write that starts later has a higher
+// version. With kv_pairs.version the row keeps the highest version written
+// (an older write that reaches MySQL last changes nothing, and a delete
+// removes only older rows), and the cache keeps the same one (ShardedCache
+// drops older puts and stale miss fills), so concurrent writes need no lock
+// across the database and the cache. The clock starts above the highest
+// version already stored.
+atomic<uint64_t> last_version{0};
+
+uint64_t next_version()
+{
+    uint64_t now = static_cast<uint64_t>(
+        chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count());
+    uint64_t last = last_version.load();
+    uint64_t next;
+    do
+    {
+        next = max(now, last + 1);
+    } while (!last_version.compare_exchange_weak(last, next));
+    return next;
+}
+
+// upsert_row in its own statement, bypassing group commit
+bool upsert_row_now(const string &key, const string &stored, uint8_t flags, int64_t expires_at, uint64_t version)
+{
+    db_calls++;
+    sql::Connection *con = nullptr;
+    try
+    {
+        con = db_pool.acquire();
+        if (!con)
+        {
+            cerr << "DB acquire failed" << endl;
+            return false;
+        }
+
+        sql::PreparedStatement &stmt = *db_pool.kv_statements(con).upsert;
+        istringstream blob(stored);
+        unsigned param = 1;
+        bind_upsert_row(stmt, param, key, blob, flags, expires_at, version);
+        stmt.executeUpdate();
+    }
+    catch (const sql::SQLException &e)
+    {
+        cerr << "DATABASE ERROR (save): " << e.what() << endl;
+        if (con)
+            db_pool.release(con);
+        return false;
+    }
+    catch (const exception &e)
+    {
+        cerr << "DATABASE ERROR (save unknown): " << e.what() << endl;
+        if (con)
+            db_pool.release(con);
+        return false;
+    }
+
+    if (con)
+        db_pool.release(con);
+    return true;
+}
+
+// delete_row in its own statement, bypassing group commit
+int delete_row_now(const string &key, uint64_t version)
+{
+    db_calls++;
+    sql::Connection *con = nullptr;
+    int update_count = 0;
+    try
+    {
+        con = db_pool.acquire();
+        if (!con)
+        {
+            cerr << "DB acquire failed (delete)" << endl;
+            return -1;
+        }
+
+        KvStatements &stmts = db_pool.kv_statements(con);
+        sql::PreparedStatement &stmt = *stmts.remove;
+        if (tombstones_supported)
+        {
+            int64_t now = unix_now_ms();
+            stmt.setInt64(1, now);
+            stmt.setUInt64(2, version);
+            stmt.setString(3, key);
+            stmt.setUInt64(4, version);
+            stmt.setInt64(5, now);
+            update_count = stmt.executeUpdate();
+            // No live row older than the delete: still leave the tombstone,
+            // unless a newer row is there
+            if (update_count == 0)
+            {
+                istringstream blob;
+                unsigned param = 1;
+                bind_upsert_row(*stmts.upsert, param, key, blob, 0, now, version);
+                stmts.upsert->executeUpdate();
+            }
+        }
+        else
+        {
+            stmt.setString(1, key);
+            if (version_supported)
+                stmt.setUInt64(2, version);
+            update_count = stmt.executeUpdate();
+        }
+    }
+    catch (const sql::SQLException &e)
+    {
+        cerr << "DATABASE ERROR (delete): " << e.what() << endl;
+        if (con)
+            db_pool.release(con);
+        return -1;
+    }
+    catch (const exception &e)
+    {
+        cerr << "DATABASE ERROR (delete unknown): " << e.what() << endl;
+        if (con)
+            db_pool.release(con);
+        return -1;
+    }
+
+    if (con)
+        db_pool.release(con);
+    return update_count;
+}
+
+// -------------------- Group commit --------------------
+// With GROUP_COMMIT_WINDOW_US, concurrent writes and deletes share one
+// transaction instead of committing (and syncing the redo log) one by one.
+// The first write to arrive leads a batch: it waits up to the window (or
+// until GROUP_COMMIT_MAX_BATCH writes have joined), takes the batch and runs
+// it while the next writes gather behind a new leader. A full batch takes no
+// more writes, so batches (and the statements prepared for their sizes)
+// never exceed GROUP_COMMIT_MAX_BATCH. A batch is
+//
+//   SELECT item_key ... WHERE item_key IN (...) FOR UPDATE       (deletes)
+//   DELETE FROM kv_pairs WHERE item_key IN (...)
+//   INSERT ... VALUES (...), (...) ON DUPLICATE KEY UPDATE ...   (writes)
+//   COMMIT
+//
+// With tombstones there is no DELETE: each delete is a tombstone row of the
+// INSERT.
+//
+// A key written more than once in a batch is written once, by its highest
+// version (the order MySQL would have kept anyway). The SELECT locks the
+// rows to delete and tells each DELETE request whether it removed a row;
+// with versions, a row newer than the delete is left alone. Every waiting
+// request then gets its own result, and all fail if the transaction does.
+//
+// Rows are locked in key order, but a batch still conflicts with single-row
+// writes and other clients. A batch that hits a deadlock or a lock wait
+// timeout is rolled back and run again, up to GROUP_COMMIT_RETRIES times;
+// after that its writes run one by one, so one hot row cannot fail the rest.
+long long GROUP_COMMIT_WINDOW_US = 0; // 0 = every write commits on its own
+size_t GROUP_COMMIT_MAX_BATCH = 64;
+const int GROUP_COMMIT_RETRIES = 3;
+const int ER_LOCK_DEADLOCK = 1213;
+const int ER_LOCK_WAIT_TIMEOUT = 1205;
+
+struct CombinedWrite
+{
+    const string *key;
+    const string *stored; // value as stored; null = delete
+    uint8_t flags;
+    int64_t expires_at;
+    uint64_t version;
+    int result; // write: 1 = done; delete: rows deleted; -1 = failed
+    bool done;
+};
+
+struct GroupCommitProgress
+{
+    atomic<long long> batches{0};
+    atomic<long long> writes{0}; // writes and deletes run in a batch
+    atomic<long long> max_batch{0};
+    atomic<long long> failed{0};    // batches rolled back
+    atomic<long long> retries{0};   // batches run again after a deadlock or lock wait timeout
+    atomic<long long> fallbacks{0}; // batches that ran one write at a time
+};
+GroupCommitProgress group_commit;
+
+mutex group_commit_mutex;
+condition_variable group_commit_full; // a batch reached GROUP_COMMIT_MAX_BATCH
+condition_variable group_commit_done; // a batch finished
+// The batch new writes join; null = none or full (the next write leads a new one)
+shared_ptr<vector<CombinedWrite *>> group_commit_batch;
+
+// Run batch in one transaction and fill in every result
+void run_write_batch(const vector<CombinedWrite *> &batch)
+{
+    // The highest version of each key wins. Keys are kept sorted so that
+    // concurrent batches lock rows in the same order.
+    map<string, CombinedWrite *> latest;
+    for (CombinedWrite *w : batch)
+    {
+        CombinedWrite *&slot = latest[*w->key];
+        if (!slot || slot->version < w->version)
+            slot = w;
+    }
+    vector<CombinedWrite *> writes, deletes;
+    map<string, uint64_t> delete_versions; // keys with any delete -> highest delete version
+    for (auto &kv : latest)
+        (kv.second->stored ? writes : deletes).push_back(kv.second);
+    for (CombinedWrite *w : batch)
+        if (!w->stored)
+        {
+            uint64_t &v = delete_versions[*w->key];
+            v = max(v, w->version);
+        }
+
+    unordered_set<string> removed; // keys whose row a delete of this batch removed
+    db_calls++;
+    sql::Connection *con = nullptr;
+    bool ok = false;
+    bool conflicted = false; // still deadlocking after the retries
+    try
+    {
+        con = db_pool.acquire();
+        if (!con)
+            cerr << "DB acquire failed (group commit)" << endl;
+        for (int attempt = 0; con && !ok; ++attempt)
+        {
+            KvStatements &stmts = db_pool.kv_statements(con);
+            int64_t now = unix_now_ms(); // tombstones' expires_at
+            removed.clear();
+            con->setAutoCommit(false);
+            try
+            {
+                if (!delete_versions.empty())
+                {
+                    sql::PreparedStatement &lock = batch_statement(
+                        con, stmts.batch_locks, delete_versions.size(), [](size_t n)
+                        { return string("SELECT item_key") + (version_supported ? ", version" : "") +
+                                 (tombstones_supported ? ", COALESCE(expires_at, 0) AS expires_at" : "") +
+                                 " FROM kv_pairs WHERE item_key IN (" + sql_placeholders(n) + ") FOR UPDATE"; });
+                    unsigned param = 1;
+                    for (auto &kv : delete_versions)
+                        lock.setString(param++, kv.first);
+                    // Before the writes: rows a delete in this batch is newer
+                    // than were removed by it, even if a later write of the
+                    // batch puts the key back
+                    vector<string> doomed;
+                    unique_ptr<sql::ResultSet> res(lock.executeQuery());
+                    while (res->next())
+                    {
+                        string key = res->getString("item_key");
+                        auto it = delete_versions.find(key);
+                        if (it == delete_versions.end() ||
+                            (version_supported && static_cast<uint64_t>(res->getInt64("version")) >= it->second))
+                            continue;
+                        // A tombstone (or an expired row) was already gone
+                        if (tombstones_supported)
+                        {
+                            int64_t expires_at = res->getInt64("expires_at");
+                            if (expires_at > 0 && expires_at <= now)
+                                continue;
+                        }
+                        removed.insert(key);
+                        if (!latest[key]->stored)
+                            doomed.push_back(std::move(key));
+                    }
+                    sort(doomed.begin(), doomed.end());
+                    // With tombstones the deletes are rows of the upsert below
+                    if (!doomed.empty() && !tombstones_supported)
+                    {
+                        sql::PreparedStatement &remove = batch_statement(
+                            con, stmts.batch_removes, doomed.size(), [](size_t n)
+                            { return "DELETE FROM kv_pairs WHERE item_key IN (" + sql_placeholders(n) + ")"; });
+                        param = 1;
+                        for (const string &key : doomed)
+                            remove.setString(param++, key);
+                        remove.executeUpdate();
+                    }
+                }
+                // Tombstones go in key order with the writes, which keeps
+                // the lock order sorted
+                vector<CombinedWrite *> rows = writes;
+                if (tombstones_supported)
+                {
+                    rows.insert(rows.end(), deletes.begin(), deletes.end());
+                    sort(rows.begin(), rows.end(), [](const CombinedWrite *a, const CombinedWrite *b)
+                         { return *a->key < *b->key; });
+                }
+                if (!rows.empty())
+                {
+                    sql::PreparedStatement &stmt = batch_statement(con, stmts.batch_upserts, rows.size(), upsert_sql);
+                    deque<istringstream> blobs;
+                    unsigned param = 1;
+                    for (CombinedWrite *w : rows)
+                    {
+                        if (w->stored)
+                        {
+                            blobs.emplace_back(*w->stored);
+                            bind_upsert_row(stmt, param, *w->key, blobs.back(), w->flags, w->expires_at, w->version);
+                        }
+                        else
+                        {
+                            blobs.emplace_back();
+                            bind_upsert_row(stmt, param, *w->key, blobs.back(), 0, now, w->version);
+                        }
+                    }
+                    stmt.executeUpdate();
+                }
+                con->commit();
+                ok = true;
+            }
+            catch (const sql::SQLException &e)
+            {
+                try
+                {
+                    con->rollback();
+                }
+                catch (...)
+                {
+                }
+                con->setAutoCommit(true);
+                if (e.getErrorCode() != ER_LOCK_DEADLOCK && e.getErrorCode() != ER_LOCK_WAIT_TIMEOUT)
+                    throw;
+                if (attempt >= GROUP_COMMIT_RETRIES)
+                {
+                    cerr << "DATABASE ERROR (group commit, giving up on the batch): " << e.what() << endl;
+                    conflicted = true;
+                    break;
+                }
+                group_commit.retries++;
+                continue;
+            }
+            catch (...)
+            {
+                try
+                {
+                    con->rollback();
+                }
+                catch (...)
+                {
+                }
+                con->setAutoCommit(true);
+                throw;
+            }
+            con->setAutoCommit(true);
+        }
+    }
+    catch (const sql::SQLException &e)
+    {
+        cerr << "DATABASE ERROR (group commit): " << e.what() << endl;
+    }
+    catch (const exception &e)
+    {
+        cerr << "DATABASE ERROR (group commit unknown): " << e.what() << endl;
+    }
+
+    if (con)
+        db_pool.release(con);
+
+    if (conflicted)
+    {
+        // In arrival order, as they would have run without group commit
+        group_commit.fallbacks++;
+        for (CombinedWrite *w : batch)
+            w->result = w->stored ? (upsert_row_now(*w->key, *w->stored, w->flags, w->expires_at, w->version) ? 1 : -1)
+                                  : delete_row_now(*w->key, w->version);
+        return;
+    }
+    for (CombinedWrite *w : batch)
+        w->result = !ok ? -1 : w->stored ? 1 : static_cast<int>(removed.count(*w->key));
+    if (!ok)
+        group_commit.failed++;
+}
+
+// Queue a write (stored null = a delete) for the next batch and wait for it.
+// Returns what upsert_row (1 / -1) or delete_row would have.
+int combine_write(const string &key, const string *stored, uint8_t flags, int64_t expires_at, uint64_t version)
+{
+    CombinedWrite w{&key, stored, flags, expires_at, version, -1, false};
+    unique_lock<mutex> lk(group_commit_mutex);
+    bool lead = !group_commit_batch;
+    if (lead)
+        group_commit_batch = make_shared<vector<CombinedWrite *>>();
+    shared_ptr<vector<CombinedWrite *>> gathering = group_commit_batch;
+    gathering->push_back(&w);
+    if (gathering->size() >= GROUP_COMMIT_MAX_BATCH)
+    {
+        group_commit_batch.reset();
+        group_commit_full.notify_all();
+    }
+    if (!lead)
+    {
+        group_commit_done.wait(lk, [&]()
+                               { return w.done; });
+        return w.result;
+    }
+
+    // Leader: gather, then run the batch while the next one gathers
+    group_commit_full.wait_for(lk, chrono::microseconds(GROUP_COMMIT_WINDOW_US), [&]()
+                               { return gathering->size() >= GROUP_COMMIT_MAX_BATCH; });
+    if (group_commit_batch == gathering)
+        group_commit_batch.reset();
+    const vector<CombinedWrite *> &batch = *gathering;
+    lk.unlock();
+
+    run_write_batch(batch);
+    long long size = static_cast<long long>(batch.size());
+    group_commit.batches++;
+    group_commit.writes += size;
+    long long max_batch = group_commit.max_batch.load();
+    while (max_batch < size && !group_commit.max_batch.compare_exchange_weak(max_batch, size))
+        ;
+
+    lk.lock();
+    for (CombinedWrite *p : batch)
+        p->done = true;
+    lk.unlock();
+    group_commit_done.notify_all();
+    return w.result;
+}
+
+// Write key's row: stored is the value as stored (see encode_value),
+// expires_at a unix-ms deadline, 0 = keep forever (also clears an earlier
+// TTL). Returns false (and logs) on failure.
+bool upsert_row(const string &key, const string &stored, uint8_t flags, int64_t expires_at, uint64_t version)
+{
+    if (GROUP_COMMIT_WINDOW_US > 0)
+        return combine_write(key, &stored, flags, expires_at, version) > 0;
+    return upsert_row_now(key, stored, flags, expires_at, version);
+}
+
+// Delete key's row unless a newer version is stored. With tombstones the
+// row is replaced by (or, if there is none, becomes) a tombstone with the
+// delete's version, so an older write that reaches MySQL later is ignored.
+// Returns the number of live rows deleted, -1 (and logs) on failure.
+int delete_row(const string &key, uint64_t version)
+{
+    if (GROUP_COMMIT_WINDOW_US > 0)
+        return combine_write(key, nullptr, 0, 0, version);
+    return delete_row_now(key, version);
+}
+
+// -------------------- Write-back --------------------
+// With WRITE_BACK a POST or DELETE updates the cache, records the write in
+// write_back_pending and is acknowledged at once; WRITE_BACK_THREADS
+// flushers write it to MySQL afterwards. A key has at most one pending
+// record, so writes to it that arrive before the flush are coalesced into one
+// statement (the highest version wins, as in MySQL). One flusher at a time
+// owns a key: a write that arrives while the key is being flushed marks the
+// record queued again and the flusher re-queues it when done, so a key's
+// writes reach MySQL in order.
+//
+// A record stays pending until MySQL has it, and a GET that misses the cache
+// checks it before any SELECT, so reads see acknowledged writes even after
+// the cache evicted them. At most WRITE_BACK_QUEUE_LIMIT keys are pending; a
+// write of another key then waits for a flush. Shutdown waits up to
+// WRITE_BACK_DRAIN_S for every record to be flushed and then drops (and
+// logs) the rest, so a MySQL outage cannot hang it; writes acknowledged and
+// not yet flushed are also lost if the process dies.
+bool WRITE_BACK = false;
+size_t WRITE_BACK_QUEUE_LIMIT = 10000; // pending keys
+int WRITE_BACK_THREADS = 2;
+long long WRITE_BACK_DRAIN_S = 30;
+const int64_t WRITE_BACK_RETRY_MS = 100; // pause after a failed flush
+
+struct PendingWrite
+{
+    StoredValue value; // null data = delete
+    int64_t expires_at = 0;
+    uint64_t version = 0;
+    int64_t queued_ms = 0; // when the oldest write not being flushed yet was acknowledged
+    bool queued = false;   // waits for a flusher (in write_back_queue unless flushing)
+    bool flushing = false;
+};
+
+struct WriteBackProgress
+{
+    atomic<long long> queued{0};    // writes and deletes acknowledged from memory
+    atomic<long long> coalesced{0}; // ... that replaced a pending write of the key
+    atomic<long long> flushed{0};
+    atomic<long long> failed{0};     // flushes retried after an error
+    atomic<long long> lag_ms{0};     // summed acknowledge-to-commit time of flushes
+    atomic<long long> max_lag_ms{0};
+    atomic<long long> stalls{0}; // writers that found the queue full and waited
+    atomic<long long> stall_ms{0};
+    atomic<long long> dropped{0}; // records given up at shutdown
+};
+WriteBackProgress write_back;
+
+mutex write_back_mutex;
+condition_variable write_back_cv;      // a key was queued
+condition_variable write_back_flushed; // a record left write_back_pending
+unordered_map<string, PendingWrite> write_back_pending;
+deque<string> write_back_queue; // keys waiting for a flusher, oldest first
+bool write_back_abandoned = false; // the shutdown drain timed out; failed flushes are dropped
+
+// Record a write (value.data null = a delete) for the flushers. Waits while
+// the queue is full.
+void queue_write_back(const string &key, StoredValue value, int64_t expires_at, uint64_t version)
+{
+    unique_lock<mutex> lk(write_back_mutex);
+    if (!write_back_pending.count(key) && write_back_pending.size() >= WRITE_BACK_QUEUE_LIMIT)
+    {
+        write_back.stalls++;
+        auto start = chrono::steady_clock::now();
+        write_back_flushed.wait(lk, [&]()
+                                { return write_back_pending.count(key) || write_back_pending.size() < WRITE_BACK_QUEUE_LIMIT; });
+        write_back.stall_ms += chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    }
+    write_back.queued++;
+    PendingWrite &rec = write_back_pending[key];
+    // A newer write of the key was recorded first
+    if (version < rec.version)
+    {
+        write_back.coalesced++;
+        return;
+    }
+    if (rec.queued)
+        write_back.coalesced++;
+    else
+    {
+        rec.queued = true;
+        rec.queued_ms = unix_now_ms();
+        if (!rec.flushing)
+            write_back_queue.push_back(key);
+    }
+    rec.value = std::move(value);
+    rec.expires_at = expires_at;
+    rec.version = version;
+    lk.unlock();
+    write_back_cv.notify_one();
+}
+
+// Key's write that MySQL does not have yet: 1 = a value (copied to out if
+// given), -1 = a delete, 0 = none
+int write_back_lookup(const string &key, StoredValue *out = nullptr)
+{
+    if (!WRITE_BACK)
+        return 0;
+    lock_guard<mutex> lk(write_back_mutex);
+    auto it = write_back_pending.find(key);
+    if (it == write_back_pending.end())
+        return 0;
+    if (!it->second.value.data)
+        return -1;
+    if (out)
+        *out = it->second.value;
+    return 1;
+}
+
+void write_back_loop()
+{
+    for (;;)
+    {
+        string key;
+        PendingWrite rec;
+        {
+            unique_lock<mutex> lk(write_back_mutex);
+            // Shutdown drains the queue before it stops the flushers
+            write_back_cv.wait(lk, []()
+                               { return !write_back_queue.empty() || shutting_down; });
+            if (write_back_queue.empty())
+                return;
+            key = std::move(write_back_queue.front());
+            write_back_queue.pop_front();
+            PendingWrite &pending = write_back_pending[key];
+            pending.queued = false;
+            pending.flushing = true;
+            rec = pending;
+        }
+
+        bool ok = rec.value.data ? upsert_row(key, *rec.value.data, rec.value.flags, rec.expires_at, rec.version)
+                                 : delete_row(key, rec.version) >= 0;
+        long long lag = unix_now_ms() - rec.queued_ms;
+
+        bool requeued = false;
+        {
+            lock_guard<mutex> lk(write_back_mutex);
+            PendingWrite &pending = write_back_pending[key];
+            pending.flushing = false;
+            if (!ok && write_back_abandoned)
+            {
+                write_back.dropped++;
+                pending.queued = false;
+            }
+            else if (!ok)
+            {
+                // Retried with whatever is newest; the lag counts from this write
+                pending.queued = true;
+                pending.queued_ms = rec.queued_ms;
+            }
+            if (pending.queued)
+            {
+                write_back_queue.push_back(key);
+                requeued = true;
+            }
+            else
+                write_back_pending.erase(key);
+        }
+        if (requeued)
+            write_back_cv.notify_one();
+
+        if (ok)
+        {
+            write_back.flushed++;
+            write_back.lag_ms += lag;
+            long long max_lag = write_back.max_lag_ms.load();
+            while (max_lag < lag && !write_back.max_lag_ms.compare_exchange_weak(max_lag, lag))
+                ;
+            write_back_flushed.notify_all();
+        }
+        else
+        {
+            write_back.failed++;
+            // Not stop_wait: the shutdown drain still needs the pause
+            this_thread::sleep_for(chrono::milliseconds(WRITE_BACK_RETRY_MS));
+        }
+    }
+}
+
+// Block until every acknowledged write is in MySQL, or for at most
+// WRITE_BACK_DRAIN_S; then drop what is left so shutdown can go on
+void drain_write_back()
+{
+    unique_lock<mutex> lk(write_back_mutex);
+    if (write_back_pending.empty())
+        return;
+    cout << "[WRITE-BACK] Flushing " << write_back_pending.size() << " pending writes" << endl;
+    if (write_back_flushed.wait_for(lk, chrono::seconds(WRITE_BACK_DRAIN_S), []()
+                                    { return write_back_pending.empty(); }))
+        return;
+
+    // Records being flushed finish (or are dropped) in their flusher
+    write_back_abandoned = true;
+    write_back_queue.clear();
+    size_t dropped = 0;
+    for (auto it = write_back_pending.begin(); it != write_back_pending.end();)
+    {
+        if (it->second.flushing)
+        {
+            it->second.queued = false;
+            ++it;
+            continue;
+        }
+        it = write_back_pending.erase(it);
+        dropped++;
+    }
+    write_back.dropped += static_cast<long long>(dropped);
+    cerr << "[WRITE-BACK] MySQL did not take the pending writes within " << WRITE_BACK_DRAIN_S << " s, dropped "
+         << dropped << " of them" << endl;
+}
+
+// expires_at: unix-ms deadline, 0 = keep forever (also clears an earlier TTL)
+bool save_to_database(const string &key, const string &value, int64_t expires_at)
+{
+    snapshot_mark_dirty(key);
+    uint64_t version = next_version();
+    string stored;
+    uint8_t flags = encode_value(value, stored);
+    const string &bytes = flags ? stored : value;
+    if (WRITE_BACK)
+        queue_write_back(key, {make_shared<const string>(bytes), flags}, expires_at, version);
+    else if (!upsert_row(key, bytes, flags, expires_at, version))
+        return false;
+
+    // Update cache
+    negative_cache->erase(key);
+    cache_put(key, bytes, true, expires_at, flags, version,
+              miss_cost.average_us.load(memory_order_relaxed));
+    hot_replicas->invalidate(hash<string>{}(key));
+    miss_flights.forget(key); // later misses must not join a SELECT that predates the write
+    return true;
+}
+
+// SELECT key's live row with stmts into value/expires_at/flags/version.
+// Leaves value empty if there is none; SQL errors propagate.
+void read_row(KvStatements &stmts, const string &key, string &value, int64_t &expires_at, uint8_t &flags,
+              uint64_t &version)
+{
+    sql::PreparedStatement &stmt = *stmts.select;
+    stmt.setString(1, key);
+    if (ttl_supported)
+        stmt.setInt64(2, unix_now_ms());
+    unique_ptr<sql::ResultSet> res(stmt.executeQuery());
+
+    if (res->next())
+        read_columns(*res, value, expires_at, flags, version);
+}
+
+// -------------------- Read batching --------------------
+// With READ_BATCH_WINDOW_US, misses that reach MySQL at about the same time
+// share one SELECT (select_sql over several keys). The first miss leads the
+// batch: it waits up to the window (or until READ_BATCH_MAX misses have
+// joined), runs the query on one pooled connection while the next batch
+// gathers, and hands every waiting miss its row. A full batch takes no more
+// misses, even before its leader wakes up: the next miss leads a new one.
+// So batches never exceed READ_BATCH_MAX, and each connection prepares at
+// most READ_BATCH_MAX statements. A key asked for twice in a batch is
+// selected once. The fetch cost a miss records (see Miss cost) is its own
+// wait, window included.
+long long READ_BATCH_WINDOW_US = 0; // 0 = every miss runs its own SELECT
+size_t READ_BATCH_MAX = 32;
+
+struct BatchedRead
+{
+    const string *key;
+    string value; // empty = no live row
+    int64_t expires_at;
+    uint8_t flags;
+    uint64_t version;
+    bool ok;
+    bool done;
+};
+
+// Batch sizes 1, 2, 3-4, 5-8, ..., 33-64 and above 64
+const size_t READ_BATCH_BUCKETS = 8;
+
+struct ReadBatchProgress
+{
+    atomic<long long> batches{0};
+    atomic<long long> reads{0};  // misses answered by a batch
+    atomic<long long> failed{0}; // batches whose SELECT failed
+    atomic<long long> sizes[READ_BATCH_BUCKETS]{};
+};
+ReadBatchProgress read_batch;
+
+mutex read_batch_mutex;
+condition_variable read_batch_full; // a batch reached READ_BATCH_MAX
+condition_variable read_batch_done; // a batch finished
+shared_ptr<vector<BatchedRead *>> read_batch_gathering; // the batch new misses join; null = none or full
+
+// SELECT every key of batch at once and fill in the results
+void run_read_batch(const vector<BatchedRead *> &batch)
+{
+    map<string, vector<BatchedRead *>> wanted;
+    for (BatchedRead *r : batch)
+        wanted[*r->key].push_back(r);
+
+    db_calls++;
+    sql::Connection *con = nullptr;
+    bool ok = false;
+    try
+    {
+        con = db_pool.acquire();
+        if (!con)
+            cerr << "DB acquire failed (read batch)" << endl;
+        else
+        {
+            sql::PreparedStatement &stmt =
+                batch_statement(con, db_pool.kv_statements(con).batch_selects, wanted.size(), select_sql);
+            unsigned param = 1;
+            for (auto &kv : wanted)
+                stmt.setString(param++, kv.first);
+            if (ttl_supported)
+                stmt.setInt64(param++, unix_now_ms());
+            unique_ptr<sql::ResultSet> res(stmt.executeQuery());
+            while (res->next())
+            {
+                // item_key is the key as asked for, whatever the collation
+                auto it = wanted.find(res->getString("item_key"));
+                if (it == wanted.end())
+                    continue;
+                BatchedRead *first = it->second.front();
+                read_columns(*res, first->value, first->expires_at, first->flags, first->version);
+                for (size_t i = 1; i < it->second.size(); ++i)
+                {
+                    BatchedRead *r = it->second[i];
+                    r->value = first->value;
+                    r->expires_at = first->expires_at;
+                    r->flags = first->flags;
+                    r->version = first->version;
+                }
+            }
+            ok = true;
+        }
+    }
+    catch (const sql::SQLException &e)
+    {
+        cerr << "DATABASE ERROR (read batch): " << e.what() << endl;
+    }
+    catch (const exception &e)
+    {
+        cerr << "DATABASE ERROR (read batch unknown): " << e.what() << endl;
+    }
+
+    if (con)
+        db_pool.release(con);
+
+    for (BatchedRead *r : batch)
+        r->ok = ok;
+    if (!ok)
+        read_batch.failed++;
+}
+
+// read_row through the next batch. Returns false if the SELECT failed.
+bool batch_read(const string &key, string &value, int64_t &expires_at, uint8_t &flags, uint64_t &version)
+{
+    BatchedRead r{&key, string(), 0, 0, 0, false, false};
+    unique_lock<mutex> lk(read_batch_mutex);
+    bool lead = !read_batch_gathering;
+    if (lead)
+        read_batch_gathering = make_shared<vector<BatchedRead *>>();
+    shared_ptr<vector<BatchedRead *>> gathering = read_batch_gathering;
+    gathering->push_back(&r);
+    if (gathering->size() >= READ_BATCH_MAX)
+    {
+        read_batch_gathering.reset();
+        read_batch_full.notify_all();
+    }
+    if (!lead)
+    {
+        read_batch_done.wait(lk, [&]()
+                             { return r.done; });
+    }
+    else
+    {
+        // Leader: gather, then run the batch while the next one gathers
+        read_batch_full.wait_for(lk, chrono::microseconds(READ_BATCH_WINDOW_US), [&]()
+                                 { return gathering->size() >= READ_BATCH_MAX; });
+        if (read_batch_gathering == gathering)
+            read_batch_gathering.reset();
+        const vector<BatchedRead *> &batch = *gathering;
+        lk.unlock();
+
+        run_read_batch(batch);
+        size_t bucket = 0;
+        while (bucket + 1 < READ_BATCH_BUCKETS && (size_t(1) << bucket) < batch.size())
+            bucket++;
+        read_batch.sizes[bucket]++;
+        read_batch.batches++;
+        read_batch.reads += static_cast<long long>(batch.size());
+
+        lk.lock();
+        for (BatchedRead *p : batch)
+            p->done = true;
+        lk.unlock();
+        read_batch_done.notify_all();
+    }
+
+    value = std::move(r.value);
+    expires_at = r.expires_at;
+    flags = r.flags;
+    version = r.version;
+    return r.ok;
+}
+
+// Cache miss -> SELECT the row and fill the cache (or a tombstone)
+pair<int, StoredValue> select_from_database(const string &key)
+{
+    uint64_t fill_token = negative_cache->token(key);
+    uint64_t version_floor = with_cache([&](auto &cache)
+                                        { return cache.version_floor(key); });
+    sql::Connection *con = nullptr;
+    string value = "";
+    int64_t expires_at = 0;
+    uint8_t flags = 0;
+    uint64_t version = 0;
+    uint32_t cost_us = 0;
+    try
+    {
+        if (READ_BATCH_WINDOW_US > 0)
+        {
+            auto start = chrono::steady_clock::now();
+            if (!batch_read(key, value, expires_at, flags, version))
+                return {500, {}};
+            cost_us = elapsed_us(start);
+        }
+        else
+        {
+            db_calls++;
+            con = db_pool.acquire();
+            if (!con)
+            {
+                cerr << "DB acquire failed (get)" << endl;
+                return {500, {}};
+            }
+            auto start = chrono::steady_clock::now();
+            read_row(db_pool.kv_statements(con), key, value, expires_at, flags, version);
+            cost_us = elapsed_us(start);
+        }
+        record_select_latency(cost_us);
+    }
+    catch (const sql::SQLException &e)
+    {
+        cerr << "DATABASE ERROR (get): " << e.what() << endl;
+        if (con)
+            db_pool.release(con);
+        return {500, {}};
+    }
+    catch (const exception &e)
+    {
+        cerr << "DATABASE ERROR (get unknown): " << e.what() << endl;
+        if (con)
+            db_pool.release(con);
+        return {500, {}};
+    }
+
+    if (con)
+        db_pool.release(con);
+
+    if (!value.empty())
+    {
+        SharedValue shared = make_shared<const string>(std::move(value));
+        // Dropped if a write or delete raced with the SELECT
+        with_cache([&](auto &cache)
+                   { return cache.fill_miss(key, shared, version, version_floor, expires_at, flags, cost_us); });
+        return {200, {shared, flags}};
+    }
+    else
+    {
+        negative_cache->put(key, fill_token);
+        return {404, {}};
+    }
+}
+
+// -------------------- Refresh-ahead --------------------
+// With CACHE_TTL_MS a cached value is re-read from MySQL once it is that old.
+// A hit in the last REFRESH_AHEAD_PERCENT of that lifetime returns the cached
+// value and queues the key for a background refresh, so a hot key is renewed
+// before any request has to wait for it. For STALE_SERVE_MS past the
+// lifetime the old value is still served (and the refresh queued), which
+// keeps readers answered while MySQL is slow or down; after that the entry is
+// gone and the next GET is an ordinary miss.
+//
+// One thread works the queue on its own connection, so refreshes never wait
+// for or hold a pooled one. A refreshed value is installed only if no write
+// reached the cache since the hit that queued it (ShardedCache::refresh).
+const size_t REFRESH_QUEUE_LIMIT = 10000; // queued keys; further requests are dropped
+const int64_t REFRESH_RETRY_MS = 100;     // pause after a failed refresh
+
+struct RefreshProgress
+{
+    atomic<long long> queued{0};
+    atomic<long long> dropped{0};   // queue full
+    atomic<long long> refreshed{0}; // value re-read and installed
+    atomic<long long> removed{0};   // row was gone, entry dropped
+    atomic<long long> raced{0};     // a write got there first, result discarded
+    atomic<long long> failed{0};
+    atomic<long long> stale_hits{0}; // hits served past CACHE_TTL_MS
+};
+RefreshProgress refresh;
+
+mutex refresh_mutex;
+condition_variable refresh_cv;
+deque<pair<string, int64_t>> refresh_queue; // key, stored_at of the entry that was hit
+unordered_set<string> refresh_pending;
+
+void queue_refresh(const string &key, int64_t stored_at)
+{
+    {
+        lock_guard<mutex> lk(refresh_mutex);
+        if (refresh_pending.count(key))
+            return;
+        if (refresh_queue.size() >= REFRESH_QUEUE_LIMIT)
+        {
+            refresh.dropped++;
+            return;
+        }
+        refresh_pending.insert(key);
+        refresh_queue.emplace_back(key, stored_at);
+    }
+    refresh.queued++;
+    refresh_cv.notify_one();
+}
+
+// Called on every GET hit
+void refresh_if_aging(const string &key, const EntryInfo &info)
+{
+    if (CACHE_TTL_MS <= 0)
+        return;
+    int64_t age = unix_now_ms() - info.stored_at;
+    if (age >= CACHE_TTL_MS)
+    {
+        refresh.stale_hits++;
+        queue_refresh(key, info.stored_at);
+    }
+    else if (REFRESH_AHEAD_PERCENT > 0 && age >= CACHE_TTL_MS * (100 - REFRESH_AHEAD_PERCENT) / 100)
+    {
+        queue_refresh(key, info.stored_at);
+    }
+}
+
+void refresh_loop()
+{
+    sql::Connection *con = nullptr;
+    unique_ptr<KvStatements> stmts;
+    for (;;)
+    {
+        pair<string, int64_t> job;
+        {
+            unique_lock<mutex> lk(refresh_mutex);
+            refresh_cv.wait(lk, []()
+                            { return !refresh_queue.empty() || shutting_down; });
+            if (shutting_down)
+                break;
+            job = std::move(refresh_queue.front());
+            refresh_queue.pop_front();
+        }
+        const string &key = job.first;
+
+        string value;
+        int64_t expires_at = 0;
+        uint8_t flags = 0;
+        uint64_t version = 0;
+        uint64_t floor = 0; // taken before the read, see ShardedCache::refresh
+        uint32_t cost_us = 0;
+        bool ok = true;
+        // MySQL is behind the cache until the pending write is flushed
+        if (write_back_lookup(key) != 0)
+        {
+            refresh.raced++;
+            lock_guard<mutex> lk(refresh_mutex);
+            refresh_pending.erase(key);
+            continue;
+        }
+        try
+        {
+            if (!con)
+                con = db_pool.connect_dedicated();
+            if (!stmts)
+                stmts = prepare_kv_statements(con);
+            db_calls++;
+            floor = with_cache([&](auto &cache)
+                               { return cache.version_floor(key); });
+            auto start = chrono::steady_clock::now();
+            read_row(*stmts, key, value, expires_at, flags, version);
+            cost_us = elapsed_us(start);
+        }
+        catch (const exception &e)
+        {
+            cerr << "DATABASE ERROR (refresh): " << e.what() << endl;
+            ok = false;
+            stmts.reset();
+            try
+            {
+                delete con;
+            }
+            catch (...)
+            {
+            }
+            con = nullptr;
+        }
+
+        if (ok)
+        {
+            SharedValue fresh = value.empty() ? nullptr : make_shared<const string>(std::move(value));
+            if (!with_cache([&](auto &cache)
+                            { return cache.refresh(key, job.second, floor, fresh, expires_at, flags, version, cost_us); }))
+                refresh.raced++;
+            else
+            {
+                hot_replicas->invalidate(hash<string>{}(key));
+                (fresh ? refresh.refreshed : refresh.removed)++;
+            }
+        }
+        else
+        {
+            refresh.failed++;
+        }
+        {
+            lock_guard<mutex> lk(refresh_mutex);
+            refresh_pending.erase(key);
+        }
+        if (!ok)
+            stop_wait(chrono::milliseconds(REFRESH_RETRY_MS));
+    }
+    stmts.reset();
+    delete con;
+}
+
+// The value is returned as stored (possibly compressed) in a shared immutable
+// buffer; for large values it is the same buffer the cache holds, so nothing
+// is copied on the way out.
+pair<int, StoredValue> get_from_database(const string &key)
+{
+    // First try cache
+    SharedValue val;
+    EntryInfo info;
+    if (cache_get(key, val, &info))
+    {
+        // cache_get already increments cache_hits
+        refresh_if_aging(key, info);
+        record_hit_saving(info);
+        return {200, {val, info.flags}};
+    }
+
+    // Written or deleted but not flushed yet?
+    StoredValue pending;
+    int pending_state = write_back_lookup(key, &pending);
+    if (pending_state != 0)
+        return pending_state > 0 ? pair<int, StoredValue>{200, pending} : pair<int, StoredValue>{404, {}};
+
+    // Known to be absent?
+    if (negative_cache->contains(key))
+        return {404, {}};
+
+    // Not restored from the snapshot yet?
+    StoredValue restored = snapshot_lookup(key);
+    if (restored.data)
+        return {200, restored};
+
+    if (!COALESCE_MISSES)
+        return select_from_database(key);
+    // Concurrent misses for the key share one SELECT
+    bool shared = false;
+    return miss_flights.run(key, [&]()
+                            { return select_from_database(key); }, shared);
+}
+
+int delete_from_database(const string &key)
+{
+    snapshot_mark_dirty(key);
+    uint64_t fill_token = negative_cache->token(key);
+    // After the token: a write newer than this delete always invalidates
+    // the tombstone recorded below
+    uint64_t version = next_version();
+    int update_count = 1;
+    if (WRITE_BACK)
+    {
+        // The delete is not run yet, so ask the read path (cache, pending
+        // writes, MySQL) whether there is a row to delete
+        int status = get_from_database(key).first;
+        if (status == 500)
+            return 500;
+        update_count = status == 404 ? 0 : 1;
+        queue_write_back(key, {}, 0, version);
+    }
+    else if ((update_count = delete_row(key, version)) < 0)
+        return 500;
+
+    // Either way the key is now absent from the DB (and must not linger in
+    // the cache, e.g. restored from a snapshot after the row was deleted)
+    negative_cache->put(key, fill_token);
+    cache_delete(key, version);
+    hot_replicas->invalidate(hash<string>{}(key));
+    miss_flights.forget(key);
+    if (update_count > 0)
+    {
+        return 200;
+    }
+    else
+    {
+        return 404;
+    }
+}
+
+// Run alter if kv_pairs has no column named column. Returns false (and logs)
+// if the column is missing and could not be added.
+bool ensure_column(const string &column, const string &alter)
+{
+    sql::Connection *con = db_pool.acquire();
+    if (!con)
+        return false;
+    bool ok = false;
+    try
+    {
+        unique_ptr<sql::Statement> stmt(con->createStatement());
+        unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+            "SELECT COUNT(*) AS n FROM information_schema.COLUMNS WHERE TABLE_SCHEMA = DATABASE() "
+            "AND TABLE_NAME = 'kv_pairs' AND COLUMN_NAME = '" + column + "'"));
+        if (res->next() && res->getInt("n") == 0)
+        {
+            stmt->execute(alter);
+            cout << "[SCHEMA] Added kv_pairs." << column << endl;
+        }
+        ok = true;
+    }
+    catch (const sql::SQLException &e)
+    {
+        cerr << "[SCHEMA] Could not add kv_pairs." << column << ": " << e.what() << endl;
+    }
+    db_pool.release(con);
+    return ok;
+}
+
+// Add kv_pairs.item_flags, the encoding of each stored value
+bool ensure_flags_column()
+{
+    return ensure_column("item_flags", "ALTER TABLE kv_pairs ADD COLUMN item_flags TINYINT UNSIGNED NOT NULL DEFAULT 0");
+}
+
+// Add kv_pairs.version and start the version clock above every stored version
+bool ensure_version_column()
+{
+    if (!ensure_column("version", "ALTER TABLE kv_pairs ADD COLUMN version BIGINT UNSIGNED NOT NULL DEFAULT 0"))
+        return false;
+    sql::Connection *con = db_pool.acquire();
+    if (!con)
+        return false;
+    bool ok = false;
+    try
+    {
+        unique_ptr<sql::Statement> stmt(con->createStatement());
+        unique_ptr<sql::ResultSet> res(stmt->executeQuery("SELECT COALESCE(MAX(version), 0) AS v FROM kv_pairs"));
+        if (res->next())
+        {
+            uint64_t highest = static_cast<uint64_t>(res->getInt64("v"));
+            uint64_t last = last_version.load();
+            while (last < highest && !last_version.compare_exchange_weak(last, highest))
+                ;
+        }
+        ok = true;
+    }
+    catch (const sql::SQLException &e)
+    {
+        cerr << "[SCHEMA] Could not read kv_pairs.version: " << e.what() << endl;
+    }
+    db_pool.release(con);
+    return ok;
+}
+
+// Compressed values are binary: make kv_pairs.item_value a BLOB type if it is
+// a text type. Returns false (and logs) if it is not and cannot be changed.
+bool ensure_binary_value_column()
+{
+    sql::Connection *con = db_pool.acquire();
+    if (!con)
+        return false;
+    bool ok = false;
+    try
+    {
+        unique_ptr<sql::Statement> stmt(con->createStatement());
+        unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+            "SELECT DATA_TYPE, IS_NULLABLE FROM information_schema.COLUMNS WHERE TABLE_SCHEMA = DATABASE() "
+            "AND TABLE_NAME = 'kv_pairs' AND COLUMN_NAME = 'item_value'"));
+        if (res->next())
+        {
+            string type = res->getString("DATA_TYPE");
+            bool nullable = res->getString("IS_NULLABLE") == "YES";
+            if (type.find("blob") != string::npos || type.find("binary") != string::npos)
             {
-                delete c;
+                ok = true;
             }
-            catch (...)
+            else
             {
+                stmt->execute(string("ALTER TABLE kv_pairs MODIFY item_value LONGBLOB ") + (nullable ? "NULL" : "NOT NULL"));
+                cout << "[SCHEMA] Changed kv_pairs.item_value from " << type << " to LONGBLOB" << endl;
+                ok = true;
             }
         }
-        pool.clear();
-        in_use.clear();
     }
-
-    ~ConnectionPool()
+    catch (const sql::SQLException &e)
     {
-        cleanup();
+        cerr << "[SCHEMA] Could not make kv_pairs.item_value binary: " << e.what() << endl;
     }
-};
-
-ConnectionPool db_pool;
+    db_pool.release(con);
+    return ok;
+}
 
-// -------------------- Database operations (use pool) --------------------
+// -------------------- Expiry --------------------
+// Keys stored with a ttl get kv_pairs.expires_at (unix ms) and the same
+// deadline on their cache entry. Expired rows are never returned by
+// get_from_database; the cache drops expired entries from its timing wheel
+// every EXPIRY_TICK_MS, and the rows themselves are removed from MySQL every
+// TTL_SWEEP_INTERVAL_MS with batched DELETEs (one statement per
+// TTL_DELETE_BATCH rows, using the expires_at index).
+const int64_t EXPIRY_TICK_MS = 100;
+
+// Add kv_pairs.expires_at (and its index) if the table predates TTL support
+bool ensure_ttl_column()
+{
+    return ensure_column("expires_at", "ALTER TABLE kv_pairs ADD COLUMN expires_at BIGINT NULL, ADD INDEX idx_kv_expires_at (expires_at)");
+}
 
-bool save_to_database(const string &key, const string &value)
+// Delete every expired row, TTL_DELETE_BATCH rows per statement
+long long delete_expired_rows()
 {
-    db_calls++;
-    sql::Connection *con = nullptr;
+    sql::Connection *con = db_pool.acquire();
+    if (!con)
+        return 0;
+    long long total = 0;
     try
     {
-        con = db_pool.acquire();
-        if (!con)
-        {
-            cerr << "DB acquire failed" << endl;
-            return false;
-        }
-
         unique_ptr<sql::Statement> stmt(con->createStatement());
-        // Very small sanitization: escape single quotes by doubling them
-        auto esc = [](const string &s)
+        // Tombstones (empty values) are kept for TOMBSTONE_TTL_MS past the delete
+        int64_t now = unix_now_ms();
+        string query = "DELETE FROM kv_pairs WHERE expires_at IS NOT NULL AND expires_at <= " + to_string(now) +
+                       " AND (item_value <> '' OR expires_at <= " + to_string(now - TOMBSTONE_TTL_MS) + ")" +
+                       " LIMIT " + to_string(TTL_DELETE_BATCH);
+        while (true)
         {
-            string out;
-            out.reserve(s.size());
-            for (char c : s)
-            {
-                if (c == '\'')
-                    out.push_back('\'');
-                out.push_back(c);
-            }
-            return out;
-        };
-
-        string qkey = esc(key);
-        string qval = esc(value);
-
-        string query = "INSERT INTO kv_pairs(item_key, item_value) VALUES('" + qkey + "', '" + qval +
-                       "') ON DUPLICATE KEY UPDATE item_value='" + qval + "'";
-        stmt->execute(query);
+            db_calls++;
+            int n = stmt->executeUpdate(query);
+            total += n;
+            if (n < TTL_DELETE_BATCH)
+                break;
+        }
     }
     catch (const sql::SQLException &e)
     {
-        cerr << "DATABASE ERROR (save): " << e.what() << endl;
-        if (con)
-            db_pool.release(con);
-        return false;
+        cerr << "DATABASE ERROR (expire): " << e.what() << endl;
     }
-    catch (const exception &e)
+    db_pool.release(con);
+    if (total > 0)
     {
-        cerr << "DATABASE ERROR (save unknown): " << e.what() << endl;
-        if (con)
-            db_pool.release(con);
-        return false;
+        expired_db_rows += total;
+        cout << "[EXPIRE] Deleted " << total << " expired rows" << endl;
     }
-
-    if (con)
-        db_pool.release(con);
-
-    // Update cache
-    cache_put(key, value);
-    return true;
+    return total;
 }
 
-pair<int, string> get_from_database(const string &key)
+void expiry_loop()
 {
-    // First try cache
-    string val;
-    if (cache_get(key, val))
-    {
-        // cache_get already increments cache_hits
-        return {200, val};
-    }
-
-    // Cache miss -> check DB
-    db_calls++;
-    sql::Connection *con = nullptr;
-    string value = "";
-    try
+    int64_t next_sweep = 0;
+    while (stop_wait(chrono::milliseconds(EXPIRY_TICK_MS)))
     {
-        con = db_pool.acquire();
-        if (!con)
+        int64_t now = unix_now_ms();
+        with_cache([&](auto &cache)
+                   { cache.expire(now); });
+        if (ttl_supported && now >= next_sweep)
         {
-            cerr << "DB acquire failed (get)" << endl;
-            return {500, ""};
+            delete_expired_rows();
+            next_sweep = now + TTL_SWEEP_INTERVAL_MS;
         }
+    }
+}
 
-        unique_ptr<sql::Statement> stmt(con->createStatement());
-        // simple escape
-        auto esc = [](const string &s)
+// -------------------- Memory governor --------------------
+// With MEMORY_LIMIT_BYTES a background thread compares the process RSS (from
+// /proc/self/statm) with the limit every GOVERNOR_INTERVAL_MS and moves the
+// cache's byte budget:
+//
+//  - RSS above 95% of the limit: the budget drops by the excess over 90%
+//    and the cache is trimmed down to it in batches of GOVERNOR_EVICT_BATCH
+//    entries per shard lock, never on a request thread. Freed heap is then
+//    handed back to the OS where the allocator allows it.
+//  - RSS below 80% and the cache filling its budget: the budget grows by the
+//    headroom up to 90%, never above cache_byte_ceiling().
+//
+// The budget never drops below 1/20 of the ceiling. Each change is kept with
+// its reason for /stats.
+const size_t GOVERNOR_EVICT_BATCH = 256;
+const size_t GOVERNOR_HISTORY = 16;
+
+struct GovernorChange
+{
+    int64_t at_ms;
+    size_t from;
+    size_t to;
+    string reason;
+};
+
+struct GovernorProgress
+{
+    atomic<size_t> rss{0};
+    atomic<long long> shrinks{0};
+    atomic<long long> grows{0};
+    atomic<long long> evictions{0};
+    mutex history_mutex;
+    deque<GovernorChange> history; // newest last
+};
+GovernorProgress governor;
+
+// Resident set size of this process, 0 if unknown
+size_t read_rss_bytes()
+{
+    ifstream statm("/proc/self/statm");
+    size_t total_pages = 0, resident_pages = 0;
+    if (!(statm >> total_pages >> resident_pages))
+        return 0;
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+void record_budget_change(size_t from, size_t to, const string &reason)
+{
+    cout << "[GOVERNOR] Cache budget " << from << " -> " << to << " bytes: " << reason << endl;
+    lock_guard<mutex> lk(governor.history_mutex);
+    governor.history.push_back({unix_now_ms(), from, to, reason});
+    if (governor.history.size() > GOVERNOR_HISTORY)
+        governor.history.pop_front();
+}
+
+void governor_loop()
+{
+    const size_t ceiling = cache_byte_ceiling();
+    const size_t min_budget = ceiling / 20;
+    const size_t high = MEMORY_LIMIT_BYTES / 100 * 95;
+    const size_t target = MEMORY_LIMIT_BYTES / 100 * 90;
+    const size_t low = MEMORY_LIMIT_BYTES / 100 * 80;
+    while (stop_wait(chrono::milliseconds(GOVERNOR_INTERVAL_MS)))
+    {
+        size_t rss = read_rss_bytes();
+        if (rss == 0)
+            continue;
+        governor.rss = rss;
+        size_t budget = with_cache([](auto &cache)
+                                   { return cache.byte_capacity(); });
+        size_t used = with_cache([](auto &cache)
+                                 { return cache.bytes(); });
+
+        if (rss > high && budget > min_budget)
         {
-            string out;
-            out.reserve(s.size());
-            for (char c : s)
+            size_t excess = rss - target;
+            size_t wanted = max(min_budget, used > excess ? used - excess : 0);
+            if (wanted >= budget)
+                continue;
+            with_cache([&](auto &cache)
+                       { cache.set_byte_capacity(wanted); });
+            long long evicted = 0;
+            while (size_t n = with_cache([](auto &cache)
+                                         { return cache.trim(GOVERNOR_EVICT_BATCH); }))
             {
-                if (c == '\'')
-                    out.push_back('\'');
-                out.push_back(c);
+                evicted += static_cast<long long>(n);
+                this_thread::yield();
             }
-            return out;
-        };
-
-        string qkey = esc(key);
-        string query = "SELECT item_value FROM kv_pairs WHERE item_key='" + qkey + "'";
-        unique_ptr<sql::ResultSet> res(stmt->executeQuery(query));
-
-        if (res->next())
+#if defined(__GLIBC__)
+            malloc_trim(0);
+#endif
+            governor.shrinks++;
+            governor.evictions += evicted;
+            record_budget_change(budget, wanted, "rss " + to_string(rss) + " over 95% of limit, evicted " + to_string(evicted));
+        }
+        else if (rss < low && budget < ceiling && used >= budget / 10 * 9)
         {
-            value = res->getString("item_value");
+            size_t wanted = min(ceiling, budget + (target - rss));
+            with_cache([&](auto &cache)
+                       { cache.set_byte_capacity(wanted); });
+            governor.grows++;
+            record_budget_change(budget, wanted, "rss " + to_string(rss) + " under 80% of limit and cache full");
         }
     }
-    catch (const sql::SQLException &e)
+}
+
+// -------------------- Warm-up --------------------
+// Preloads the cache at startup so a restart does not send every first
+// request to MySQL. Rows are chosen either from a saved hot-key list
+// (HOT_KEYS_FILE, rewritten from the cache's resident keys every
+// HOT_KEYS_SAVE_INTERVAL_S) or by recency (kv_pairs.updated_at, maintained by
+// MySQL). The work is split into independent queries that WARMUP_THREADS
+// pooled connections pull from a shared list; each result set is streamed
+// row by row. Rows only fill keys that are not cached yet, and not keys
+// whose version stripe saw a write or delete after the query started, so
+// with WARMUP_ASYNC a client's write or delete during warm-up is never undone.
+enum class WarmupMode
+{
+    OFF,
+    RECENT,
+    HOT_KEYS
+};
+WarmupMode WARMUP_MODE = WarmupMode::OFF;
+int WARMUP_THREADS = 4;
+bool WARMUP_ASYNC = false; // start serving before warm-up finishes
+string HOT_KEYS_FILE;
+long long HOT_KEYS_SAVE_INTERVAL_S = 60; // 0 = never rewrite HOT_KEYS_FILE
+const size_t WARMUP_KEYS_PER_QUERY = 500;
+
+// One unit of warm-up work: the rows of keys (bound as parameters of
+// select_sql) or, with no keys, the rows sql returns
+struct WarmupQuery
+{
+    string sql;
+    vector<string> keys;
+};
+
+enum class WarmupState
+{
+    IDLE,
+    RUNNING,
+    DONE,
+    FAILED
+};
+
+struct WarmupProgress
+{
+    atomic<WarmupState> state{WarmupState::IDLE};
+    atomic<long long> target{0};      // rows wanted
+    atomic<long long> rows_read{0};   // rows streamed from MySQL
+    atomic<long long> rows_loaded{0}; // rows that went into the cache
+    atomic<long long> started_ms{0};
+    atomic<long long> finished_ms{0};
+};
+WarmupProgress warmup;
+
+const char *warmup_mode_name(WarmupMode mode)
+{
+    switch (mode)
     {
-        cerr << "DATABASE ERROR (get): " << e.what() << endl;
-        if (con)
-            db_pool.release(con);
-        return {500, ""};
+    case WarmupMode::RECENT:
+        return "recent";
+    case WarmupMode::HOT_KEYS:
+        return "hotkeys";
+    default:
+        return "off";
     }
-    catch (const exception &e)
+}
+
+const char *warmup_state_name(WarmupState state)
+{
+    switch (state)
     {
-        cerr << "DATABASE ERROR (get unknown): " << e.what() << endl;
-        if (con)
-            db_pool.release(con);
-        return {500, ""};
+    case WarmupState::RUNNING:
+        return "running";
+    case WarmupState::DONE:
+        return "done";
+    case WarmupState::FAILED:
+        return "failed";
+    default:
+        return "idle";
     }
+}
 
-    if (con)
-        db_pool.release(con);
+// Add kv_pairs.updated_at (and its index) for recency warm-up
+bool ensure_updated_at_column()
+{
+    return ensure_column("updated_at", "ALTER TABLE kv_pairs ADD COLUMN updated_at TIMESTAMP(3) NOT NULL "
+                                       "DEFAULT CURRENT_TIMESTAMP(3) ON UPDATE CURRENT_TIMESTAMP(3), "
+                                       "ADD INDEX idx_kv_updated_at (updated_at)");
+}
 
-    if (!value.empty())
+// SELECT of live rows; condition and suffix are appended as given
+string warmup_query(const string &condition, const string &suffix)
+{
+    string query = "SELECT item_key, item_value";
+    if (ttl_supported)
+        query += ", COALESCE(expires_at, 0) AS expires_at";
+    if (flags_supported)
+        query += ", item_flags";
+    if (version_supported)
+        query += ", version";
+    query += " FROM kv_pairs WHERE " + condition;
+    if (ttl_supported)
+        query += " AND (expires_at IS NULL OR expires_at > " + to_string(unix_now_ms()) + ")";
+    return query + suffix;
+}
+
+// Recency: one query per thread over a hash partition of the keys, each
+// returning the partition's newest rows
+vector<WarmupQuery> recent_warmup_queries(size_t parts, size_t limit)
+{
+    vector<WarmupQuery> queries;
+    size_t per_part = (limit + parts - 1) / parts;
+    for (size_t i = 0; i < parts; ++i)
     {
-        cache_put(key, value);
-        return {200, value};
+        string condition = "CRC32(item_key) % " + to_string(parts) + " = " + to_string(i);
+        string suffix = (recency_supported ? " ORDER BY updated_at DESC" : "") + string(" LIMIT ") + to_string(per_part);
+        queries.push_back({warmup_query(condition, suffix), {}});
     }
-    else
+    return queries;
+}
+
+// Hot keys: select_sql queries of WARMUP_KEYS_PER_QUERY keys each. Returns
+// false if the list cannot be read.
+bool hot_key_warmup_queries(size_t limit, vector<WarmupQuery> &queries, size_t &keys_wanted)
+{
+    ifstream in(HOT_KEYS_FILE);
+    if (!in)
+        return false;
+
+    // The list holds client-supplied keys: they are bound, never spliced
+    keys_wanted = 0;
+    string line;
+    WarmupQuery query;
+    while (keys_wanted < limit && getline(in, line))
     {
-        return {404, ""};
+        if (line.empty())
+            continue;
+        query.keys.push_back(line);
+        keys_wanted++;
+        if (query.keys.size() == WARMUP_KEYS_PER_QUERY)
+        {
+            queries.push_back(std::move(query));
+            query = WarmupQuery();
+        }
     }
+    if (!query.keys.empty())
+        queries.push_back(std::move(query));
+    return true;
 }
 
-int delete_from_database(const string &key)
+// Stream one warm-up query into the cache on a pooled connection
+bool warmup_stream(const WarmupQuery &query)
 {
-    db_calls++;
-    sql::Connection *con = nullptr;
-    int update_count = 0;
+    sql::Connection *con = db_pool.acquire();
+    if (!con)
+        return false;
+    bool ok = true;
     try
     {
-        con = db_pool.acquire();
-        if (!con)
+        unique_ptr<sql::Statement> stmt;
+        unique_ptr<sql::ResultSet> res;
+        // Before the read: rows of stripes written since are dropped
+        vector<uint64_t> floors = with_cache([](auto &cache)
+                                             { return cache.version_floors(); });
+        db_calls++;
+        if (query.keys.empty())
         {
-            cerr << "DB acquire failed (delete)" << endl;
-            return 500;
+            stmt.reset(con->createStatement());
+            // A forward-only result set is read from the server as it is
+            // consumed instead of being buffered whole in the client
+            stmt->setResultSetType(sql::ResultSet::TYPE_FORWARD_ONLY);
+            res.reset(stmt->executeQuery(query.sql));
         }
-
-        unique_ptr<sql::Statement> stmt(con->createStatement());
-        // simple escape
-        auto esc = [](const string &s)
+        else
         {
-            string out;
-            out.reserve(s.size());
-            for (char c : s)
-            {
-                if (c == '\'')
-                    out.push_back('\'');
-                out.push_back(c);
-            }
-            return out;
-        };
-
-        string qkey = esc(key);
-        string query = "DELETE FROM kv_pairs WHERE item_key='" + qkey + "'";
-        update_count = stmt->executeUpdate(query);
+            sql::PreparedStatement &select =
+                batch_statement(con, db_pool.kv_statements(con).batch_selects, query.keys.size(), select_sql);
+            unsigned param = 1;
+            for (const string &key : query.keys)
+                select.setString(param++, key);
+            if (ttl_supported)
+                select.setInt64(param++, unix_now_ms());
+            res.reset(select.executeQuery());
+        }
+        while (!shutting_down && res->next())
+        {
+            string key = res->getString("item_key");
+            string value = res->getString("item_value");
+            int64_t expires_at = ttl_supported ? res->getInt64("expires_at") : 0;
+            uint8_t flags = flags_supported ? static_cast<uint8_t>(res->getInt("item_flags")) : 0;
+            uint64_t version = version_supported ? static_cast<uint64_t>(res->getInt64("version")) : 0;
+            warmup.rows_read++;
+            // Empty, or older than a write still waiting to be flushed
+            if (value.empty() || write_back_lookup(key) != 0)
+                continue;
+            if (with_cache([&](auto &cache)
+                           { return cache.fill(key, value, expires_at, flags, version, &floors); }))
+                warmup.rows_loaded++;
+        }
     }
     catch (const sql::SQLException &e)
     {
-        cerr << "DATABASE ERROR (delete): " << e.what() << endl;
-        if (con)
-            db_pool.release(con);
-        return 500;
+        cerr << "DATABASE ERROR (warm-up): " << e.what() << endl;
+        ok = false;
     }
     catch (const exception &e)
     {
-        cerr << "DATABASE ERROR (delete unknown): " << e.what() << endl;
-        if (con)
-            db_pool.release(con);
-        return 500;
+        cerr << "DATABASE ERROR (warm-up unknown): " << e.what() << endl;
+        ok = false;
     }
+    db_pool.release(con);
+    return ok;
+}
 
-    if (con)
-        db_pool.release(con);
+void run_warmup()
+{
+    warmup.started_ms = unix_now_ms();
+    warmup.state = WarmupState::RUNNING;
+
+    size_t threads = static_cast<size_t>(max(1, min(WARMUP_THREADS, DB_POOL_SIZE)));
+    vector<WarmupQuery> queries;
+    size_t target = 0;
+    bool use_hot_keys = WARMUP_MODE == WarmupMode::HOT_KEYS;
+    if (use_hot_keys && !hot_key_warmup_queries(MAX_CACHE_SIZE, queries, target))
+    {
+        cerr << "[WARMUP] Cannot read hot-key list '" << HOT_KEYS_FILE << "', warming by recency" << endl;
+        use_hot_keys = false;
+    }
+    if (!use_hot_keys)
+    {
+        target = MAX_CACHE_SIZE;
+        queries = recent_warmup_queries(threads, MAX_CACHE_SIZE);
+    }
+    warmup.target = static_cast<long long>(target);
+    cout << "[WARMUP] Loading up to " << target << " rows (" << warmup_mode_name(WARMUP_MODE) << ") with "
+         << threads << " connections" << endl;
+
+    atomic<size_t> next{0};
+    atomic<bool> failed{false};
+    vector<thread> workers;
+    for (size_t t = 0; t < min(threads, queries.size()); ++t)
+    {
+        workers.emplace_back([&]()
+                             {
+            for (size_t i = next++; i < queries.size() && !shutting_down; i = next++)
+            {
+                if (!warmup_stream(queries[i]))
+                    failed = true;
+            } });
+    }
+    for (thread &w : workers)
+        w.join();
 
-    if (update_count > 0)
+    warmup.finished_ms = unix_now_ms();
+    warmup.state = failed ? WarmupState::FAILED : WarmupState::DONE;
+    cout << "[WARMUP] " << (failed ? "Finished with errors" : "Finished") << ": " << warmup.rows_loaded.load()
+         << " of " << warmup.rows_read.load() << " rows cached in " << warmup.finished_ms - warmup.started_ms << " ms" << endl;
+}
+
+// Rewrite HOT_KEYS_FILE with the currently cached keys (write + rename, so
+// a crash never leaves a truncated list)
+void save_hot_keys()
+{
+    vector<string> keys = with_cache([](auto &cache)
+                                     { return cache.keys(MAX_CACHE_SIZE); });
+    string tmp = HOT_KEYS_FILE + ".tmp";
     {
-        cache_delete(key);
-        return 200;
+        ofstream out(tmp, ios::trunc);
+        if (!out)
+        {
+            cerr << "[WARMUP] Cannot write " << tmp << endl;
+            return;
+        }
+        for (const string &key : keys)
+            if (key.find('\n') == string::npos)
+                out << key << '\n';
     }
-    else
+    if (rename(tmp.c_str(), HOT_KEYS_FILE.c_str()) != 0)
+        cerr << "[WARMUP] Cannot replace " << HOT_KEYS_FILE << endl;
+}
+
+void hot_keys_loop()
+{
+    while (stop_wait(chrono::seconds(HOT_KEYS_SAVE_INTERVAL_S)))
     {
-        return 404;
+        // A list saved mid-warm-up would only hold what was preloaded so far
+        if (warmup.state != WarmupState::RUNNING)
+            save_hot_keys();
     }
 }
 
@@ -543,7 +2726,30 @@ void create_key_handler(const httplib::Request &req, httplib::Response &res)
         return;
     }
 
-    bool ok = save_to_database(key, value);
+    // Optional lifetime in seconds
+    int64_t expires_at = 0;
+    if (req.has_param("ttl"))
+    {
+        long long ttl = 0;
+        try
+        {
+            ttl = stoll(req.get_param_value("ttl"));
+        }
+        catch (const exception &)
+        {
+            ttl = 0;
+        }
+        if (ttl <= 0 || !ttl_supported)
+        {
+            res.status = 400;
+            res.set_content(ttl_supported ? "ttl must be a positive number of seconds" : "ttl is not supported by this database schema", "text/plain");
+            total_failures++;
+            return;
+        }
+        expires_at = unix_now_ms() + ttl * 1000;
+    }
+
+    bool ok = save_to_database(key, value, expires_at);
     if (ok)
     {
         res.set_content("Successfully saved the key.", "text/plain");
@@ -558,6 +2764,75 @@ void create_key_handler(const httplib::Request &req, httplib::Response &res)
     }
 }
 
+// Stream a value straight from its shared buffer; the provider holds a
+// reference until the response has been written
+void set_value_content(httplib::Response &res, SharedValue value)
+{
+    size_t size = value->size();
+    res.set_content_provider(size, "text/plain",
+                             [value](size_t offset, size_t length, httplib::DataSink &sink)
+                             {
+                                 return sink.write(value->data() + offset, min(length, value->size() - offset));
+                             });
+}
+
+// True if the request's Accept-Encoding allows gzip
+bool accepts_gzip(const httplib::Request &req)
+{
+    string accept = req.get_header_value("Accept-Encoding");
+    for (char &c : accept)
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    size_t pos = 0;
+    while (pos < accept.size())
+    {
+        size_t end = accept.find(',', pos);
+        if (end == string::npos)
+            end = accept.size();
+        string coding = accept.substr(pos, end - pos);
+        pos = end + 1;
+        size_t semi = coding.find(';');
+        string name = coding.substr(0, semi);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (name != "gzip" && name != "*")
+            continue;
+        size_t q = semi == string::npos ? string::npos : coding.find("q=", semi);
+        if (q == string::npos)
+            return true;
+        return atof(coding.c_str() + q + 2) > 0;
+    }
+    return false;
+}
+
+// Send a value as stored. Compressed bytes go out unchanged to clients that
+// accept gzip and are inflated for the rest. Returns false if they cannot
+// be inflated.
+bool set_stored_content(const httplib::Request &req, httplib::Response &res, const StoredValue &value)
+{
+    if (!value.gzipped())
+    {
+        set_value_content(res, value.data);
+        return true;
+    }
+    res.set_header("Vary", "Accept-Encoding");
+    if (accepts_gzip(req))
+    {
+        res.set_header("Content-Encoding", "gzip");
+        set_value_content(res, value.data);
+        compression.gzip_responses++;
+        return true;
+    }
+    SharedValue plain = decode_value(value);
+    if (!plain)
+    {
+        compression.corrupt++;
+        return false;
+    }
+    set_value_content(res, std::move(plain));
+    compression.inflated_responses++;
+    return true;
+}
+
 void read_key_handler(const httplib::Request &req, httplib::Response &res)
 {
     string key = req.get_param_value("key");
@@ -573,11 +2848,14 @@ void read_key_handler(const httplib::Request &req, httplib::Response &res)
 
     auto result = get_from_database(key);
     int status = result.first;
-    string value = result.second;
 
+    if (status == 200 && !set_stored_content(req, res, result.second))
+    {
+        cerr << "Stored value of " << key << " cannot be decoded" << endl;
+        status = 500;
+    }
     if (status == 200)
     {
-        res.set_content(value, "text/plain");
         res.status = 200;
         total_requests++;
     }
@@ -643,12 +2921,43 @@ void popular_read_handler(const httplib::Request &req, httplib::Response &res)
         return;
     }
 
-    // Only check cache for popular reads (no DB hit)
-    string value;
+    // Only check cache for popular reads (no DB hit). A key this worker
+    // reads often enough is served from its own replica; those hits are
+    // counted per worker and added to total_requests in /stats.
+    SharedValue value;
+    size_t key_hash = hash<string>{}(key);
+    if (hot_replicas->enabled() && hot_replicas->get(key, key_hash, value))
     {
-        if (cache_get(key, value))
+        set_value_content(res, std::move(value));
+        res.status = 200;
+        return;
+    }
+    {
+        uint64_t version = hot_replicas->version(key_hash);
+        EntryInfo info;
+        if (cache_get(key, value, &info))
         {
-            res.set_content(value, "text/plain");
+            record_hit_saving(info);
+            StoredValue stored{std::move(value), info.flags};
+            // Replicas hold plain values, so a compressed one is inflated
+            // only when it is about to be replicated
+            if (hot_replicas->enabled() && (!stored.gzipped() || hot_replicas->wants(key_hash)))
+            {
+                // A replica must not outlive the cached value's lifetime either
+                int64_t expires_at = info.expires_at;
+                if (CACHE_TTL_MS > 0 && (expires_at == 0 || expires_at > info.stored_at + CACHE_TTL_MS))
+                    expires_at = info.stored_at + CACHE_TTL_MS;
+                SharedValue plain = decode_value(stored);
+                if (plain)
+                    hot_replicas->offer(key, key_hash, version, plain, expires_at);
+            }
+            if (!set_stored_content(req, res, stored))
+            {
+                res.set_content("Internal server error.", "text/plain");
+                res.status = 500;
+                total_failures++;
+                return;
+            }
             res.status = 200;
             total_requests++;
             return;
@@ -669,15 +2978,193 @@ void stats_handler(const httplib::Request & /*req*/, httplib::Response &res)
 {
     std::ostringstream ss;
     ss << "{";
-    ss << "\"total_requests\":" << total_requests.load() << ",";
+    HotKeyReplicas::Stats hot = hot_replicas->stats();
+    ss << "\"total_requests\":" << total_requests.load() + hot.hits << ",";
     ss << "\"total_failures\":" << total_failures.load() << ",";
-    ss << "\"cache_hits\":" << cache_hits.load() << ",";
-    ss << "\"cache_misses\":" << cache_misses.load() << ",";
+    CacheStats cs = with_cache([](auto &cache)
+                               { return cache.stats(); });
+    ss << "\"cache_hits\":" << cs.hits << ",";
+    ss << "\"cache_misses\":" << cs.misses << ",";
+    ss << "\"cache_hit_ratio\":" << (cs.hits + cs.misses > 0 ? double(cs.hits) / double(cs.hits + cs.misses) : 0.0) << ",";
+    ss << "\"cache_admission\":\"" << (CACHE_ADMISSION == AdmissionPolicy::TINYLFU ? "tinylfu" : "none") << "\",";
+    ss << "\"cache_admitted\":" << cs.admitted << ",";
+    ss << "\"cache_rejected_admission\":" << cs.rejected_admission << ",";
     ss << "\"db_calls\":" << db_calls.load() << ",";
+    ss << "\"db_pool_size\":" << db_pool.size() << ",";
+    ss << "\"db_pool_idle\":" << db_pool.idle_count() << ",";
+    ss << "\"db_pool_waiting\":" << db_pool.waiting() << ",";
+    ss << "\"db_pool_checks\":" << db_pool.checks.load() << ",";
+    ss << "\"db_pool_reconnects\":" << db_pool.reconnects.load() << ",";
+    ss << "\"db_pool_dead\":" << db_pool.dead.load() << ",";
+    ss << "\"miss_fetches\":" << miss_flights.leaders() << ",";
+    long long select_us = miss_cost.select_us.load(), saved_us = miss_cost.saved_us.load();
+    ss << "\"miss_selects\":" << miss_cost.selects.load() << ",";
+    ss << "\"miss_select_ms\":" << select_us / 1000 << ",";
+    ss << "\"avg_select_us\":" << miss_cost.average_us.load() << ",";
+    ss << "\"db_time_saved_ms\":" << saved_us / 1000 << ",";
+    long long read_batches = read_batch.batches.load();
+    ss << "\"read_batches\":" << read_batches << ",";
+    ss << "\"read_batch_reads\":" << read_batch.reads.load() << ",";
+    ss << "\"read_batch_avg\":" << (read_batches > 0 ? double(read_batch.reads.load()) / double(read_batches) : 0.0) << ",";
+    ss << "\"read_batch_failed\":" << read_batch.failed.load() << ",";
+    // Batches by size, keyed by the largest size in each bucket
+    ss << "\"read_batch_sizes\":{";
+    for (size_t i = 0; i < READ_BATCH_BUCKETS; ++i)
+    {
+        ss << (i ? "," : "") << "\"";
+        if (i + 1 < READ_BATCH_BUCKETS)
+            ss << (size_t(1) << i);
+        else
+            ss << ">" << (size_t(1) << (i - 1));
+        ss << "\":" << read_batch.sizes[i].load();
+    }
+    ss << "},";
+    ss << "\"db_time_saved_percent\":"
+       << (saved_us + select_us > 0 ? 100.0 * saved_us / (saved_us + select_us) : 0.0) << ",";
+    ss << "\"coalesced_misses\":" << miss_flights.waiters() << ",";
+    ss << "\"cache_size\":" << cs.size << ",";
+    ss << "\"cache_bytes\":" << cs.bytes << ",";
+    ss << "\"max_cache_bytes\":" << MAX_CACHE_BYTES << ",";
+    ss << "\"cache_byte_budget\":" << with_cache([](auto &cache)
+                                                  { return cache.byte_capacity(); })
+       << ",";
+    ss << "\"memory_limit_bytes\":" << MEMORY_LIMIT_BYTES << ",";
+    ss << "\"rss_bytes\":" << read_rss_bytes() << ",";
+    ss << "\"governor_shrinks\":" << governor.shrinks.load() << ",";
+    ss << "\"governor_grows\":" << governor.grows.load() << ",";
+    ss << "\"governor_evictions\":" << governor.evictions.load() << ",";
+    ss << "\"governor_changes\":[";
+    {
+        lock_guard<mutex> lk(governor.history_mutex);
+        for (size_t i = 0; i < governor.history.size(); ++i)
+        {
+            const GovernorChange &c = governor.history[i];
+            if (i > 0)
+                ss << ",";
+            ss << "{\"at_ms\":" << c.at_ms << ",\"from\":" << c.from << ",\"to\":" << c.to << ",\"reason\":\""
+               << c.reason << "\"}";
+        }
+    }
+    ss << "],";
+    ss << "\"cache_rejected_oversize\":" << cs.rejected_oversize << ",";
+    // Slab storage: utilization is payload over reserved memory; the rest is
+    // split into internal (chunk rounding) and free (unused chunks) waste
+    const SlabAllocator::Stats &slab = cs.slab;
+    double slab_util = slab.reserved_bytes ? (double)slab.requested_bytes / slab.reserved_bytes : 0.0;
+    double slab_internal = slab.reserved_bytes ? (double)(slab.chunk_bytes - slab.requested_bytes) / slab.reserved_bytes : 0.0;
+    ss << "\"slab_pages\":" << slab.pages << ",";
+    ss << "\"slab_spare_pages\":" << slab.spare_pages << ",";
+    ss << "\"slab_reserved_bytes\":" << slab.reserved_bytes << ",";
+    ss << "\"slab_used_bytes\":" << slab.chunk_bytes << ",";
+    ss << "\"slab_requested_bytes\":" << slab.requested_bytes << ",";
+    ss << "\"slab_large_items\":" << slab.large_allocs << ",";
+    ss << "\"slab_utilization\":" << slab_util << ",";
+    ss << "\"slab_internal_fragmentation\":" << slab_internal << ",";
+    ss << "\"slab_free_fragmentation\":" << (slab.reserved_bytes ? 1.0 - slab_util - slab_internal : 0.0) << ",";
+    ss << "\"slab_classes\":[";
+    for (size_t i = 0; i < slab.classes.size(); ++i)
     {
-        std::lock_guard<std::mutex> lk(cache_mutex);
-        ss << "\"cache_size\":" << cache_map.size() << ",";
+        const SlabAllocator::ClassStats &c = slab.classes[i];
+        if (i > 0)
+            ss << ",";
+        ss << "{\"chunk_size\":" << c.chunk_size << ",\"pages\":" << c.pages << ",\"used\":" << c.chunks_used
+           << ",\"free\":" << c.chunks_free << "}";
     }
+    ss << "],";
+    ss << "\"tombstones\":" << negative_cache->size() << ",";
+    ss << "\"tombstone_capacity\":" << negative_cache->capacity() << ",";
+    ss << "\"tombstone_hits\":" << negative_cache->hits() << ",";
+    ss << "\"tombstones_dropped\":" << negative_cache->dropped() << ",";
+    ss << "\"hot_replica_hits\":" << hot.hits << ",";
+    ss << "\"hot_replica_promotions\":" << hot.promotions << ",";
+    ss << "\"hot_replica_invalidations\":" << hot.invalidations << ",";
+    ss << "\"hot_replicas\":" << hot.replicas << ",";
+    ss << "\"compress_min_bytes\":" << (compression_supported ? COMPRESS_MIN_BYTES : 0) << ",";
+    ss << "\"compressed_writes\":" << compression.compressed.load() << ",";
+    ss << "\"incompressible_writes\":" << compression.incompressible.load() << ",";
+    ss << "\"compression_saved_bytes\":" << compression.saved_bytes.load() << ",";
+    ss << "\"gzip_responses\":" << compression.gzip_responses.load() << ",";
+    ss << "\"inflated_responses\":" << compression.inflated_responses.load() << ",";
+    ss << "\"corrupt_values\":" << compression.corrupt.load() << ",";
+    ss << "\"refresh_queued\":" << refresh.queued.load() << ",";
+    ss << "\"refresh_dropped\":" << refresh.dropped.load() << ",";
+    ss << "\"refreshed\":" << refresh.refreshed.load() << ",";
+    ss << "\"refresh_removed\":" << refresh.removed.load() << ",";
+    ss << "\"refresh_raced\":" << refresh.raced.load() << ",";
+    ss << "\"refresh_failed\":" << refresh.failed.load() << ",";
+    ss << "\"stale_hits\":" << refresh.stale_hits.load() << ",";
+    ss << "\"expired_cache_entries\":" << cs.expired << ",";
+    ss << "\"stale_cache_writes\":" << cs.stale_writes << ",";
+    ss << "\"versioned_writes\":" << (version_supported ? "true" : "false") << ",";
+    size_t write_back_depth = 0;
+    long long write_back_oldest_ms = 0;
+    {
+        lock_guard<mutex> lk(write_back_mutex);
+        write_back_depth = write_back_pending.size();
+        if (!write_back_queue.empty())
+            write_back_oldest_ms = unix_now_ms() - write_back_pending.at(write_back_queue.front()).queued_ms;
+    }
+    long long write_back_flushes = write_back.flushed.load();
+    ss << "\"write_back\":" << (WRITE_BACK ? "true" : "false") << ",";
+    ss << "\"write_back_pending\":" << write_back_depth << ",";
+    ss << "\"write_back_queue_limit\":" << WRITE_BACK_QUEUE_LIMIT << ",";
+    ss << "\"write_back_queued\":" << write_back.queued.load() << ",";
+    ss << "\"write_back_coalesced\":" << write_back.coalesced.load() << ",";
+    ss << "\"write_back_flushed\":" << write_back_flushes << ",";
+    ss << "\"write_back_failed\":" << write_back.failed.load() << ",";
+    ss << "\"write_back_avg_lag_ms\":" << (write_back_flushes > 0 ? write_back.lag_ms.load() / write_back_flushes : 0) << ",";
+    ss << "\"write_back_max_lag_ms\":" << write_back.max_lag_ms.load() << ",";
+    ss << "\"write_back_oldest_ms\":" << write_back_oldest_ms << ",";
+    ss << "\"write_back_stalls\":" << write_back.stalls.load() << ",";
+    ss << "\"write_back_stall_ms\":" << write_back.stall_ms.load() << ",";
+    ss << "\"write_back_dropped\":" << write_back.dropped.load() << ",";
+    long long group_batches = group_commit.batches.load();
+    ss << "\"group_commit_batches\":" << group_batches << ",";
+    ss << "\"group_commit_writes\":" << group_commit.writes.load() << ",";
+    ss << "\"group_commit_avg_batch\":" << (group_batches > 0 ? double(group_commit.writes.load()) / double(group_batches) : 0.0) << ",";
+    ss << "\"group_commit_max_batch\":" << group_commit.max_batch.load() << ",";
+    ss << "\"group_commit_failed\":" << group_commit.failed.load() << ",";
+    ss << "\"group_commit_retries\":" << group_commit.retries.load() << ",";
+    ss << "\"group_commit_fallbacks\":" << group_commit.fallbacks.load() << ",";
+    ss << "\"expiry_timers\":" << cs.pending_timers << ",";
+    ss << "\"expired_db_rows\":" << expired_db_rows.load() << ",";
+    WarmupState ws = warmup.state.load();
+    long long warm_end = ws == WarmupState::RUNNING ? unix_now_ms() : warmup.finished_ms.load();
+    ss << "\"warmup_mode\":\"" << warmup_mode_name(WARMUP_MODE) << "\",";
+    ss << "\"warmup_state\":\"" << warmup_state_name(ws) << "\",";
+    ss << "\"warmup_target\":" << warmup.target.load() << ",";
+    ss << "\"warmup_rows_read\":" << warmup.rows_read.load() << ",";
+    ss << "\"warmup_rows_loaded\":" << warmup.rows_loaded.load() << ",";
+    ss << "\"warmup_elapsed_ms\":" << (ws == WarmupState::IDLE ? 0 : warm_end - warmup.started_ms.load()) << ",";
+    ss << "\"snapshot_state\":\"" << (SNAPSHOT_FILE.empty() ? "off" : snapshot.restoring ? "restoring" : "ready") << "\",";
+    ss << "\"snapshot_records\":" << snapshot.records.load() << ",";
+    ss << "\"snapshot_restored\":" << snapshot.restored.load() << ",";
+    ss << "\"snapshot_lazy_hits\":" << snapshot.lazy_hits.load() << ",";
+    ss << "\"snapshot_changed\":" << snapshot.changed.load() << ",";
+    ss << "\"snapshot_corrupt_records\":" << snapshot.corrupt.load() << ",";
+    ss << "\"last_snapshot_records\":" << snapshot.last_records.load() << ",";
+    ss << "\"last_snapshot_bytes\":" << snapshot.last_bytes.load() << ",";
+    ss << "\"last_snapshot_ms\":" << snapshot.last_write_duration_ms.load() << ",";
+    ss << "\"cache_shards\":[";
+    for (size_t i = 0; i < cs.shards.size(); ++i)
+    {
+        const CacheShardStats &sh = cs.shards[i];
+        if (i > 0)
+            ss << ",";
+        ss << "{\"size\":" << sh.size
+           << ",\"capacity\":" << sh.capacity
+           << ",\"bytes\":" << sh.bytes
+           << ",\"byte_capacity\":" << sh.byte_capacity
+           << ",\"hits\":" << sh.hits
+           << ",\"misses\":" << sh.misses << "}";
+    }
+    ss << "],";
+    ss << "\"cache_policy\":\"" << with_cache([](auto &cache)
+                                                { return cache.policy_name(); })
+       << "\",";
+    ss << "\"cache_locking\":\"" << with_cache([](auto &cache)
+                                                 { return cache.locking_name(); })
+       << "\",";
     ss << "\"pool_size\":" << DB_POOL_SIZE;
     ss << "}";
     res.set_content(ss.str(), "application/json");
@@ -685,9 +3172,45 @@ void stats_handler(const httplib::Request & /*req*/, httplib::Response &res)
 }
 
 // -------------------- Main --------------------
+// Stop every background thread before the cache and the pool go away:
+// flush write-back, wake and join the threads, then (if served) write the
+// final snapshot and close the pool
+void shut_down(bool served)
+{
+    drain_write_back();
+    {
+        lock_guard<mutex> lk(stop_mutex);
+        shutting_down = true;
+    }
+    stop_cv.notify_all();
+    {
+        lock_guard<mutex> lk(refresh_mutex);
+    }
+    refresh_cv.notify_all();
+    {
+        lock_guard<mutex> lk(write_back_mutex);
+    }
+    write_back_cv.notify_all();
+    for (thread &t : background_threads)
+        t.join();
+    background_threads.clear();
+    if (served && !SNAPSHOT_FILE.empty())
+        write_snapshot(true);
+    db_pool.cleanup();
+}
+
 
 int main(void)
 {
+    // SIGINT/SIGTERM are taken by a thread that stops the server, so the
+    // final snapshot is written after the last request has finished. Block
+    // them before any thread starts so every thread inherits the mask.
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
     auto db_config = read_config("db.conf");
     if (db_config.empty())
     {
@@ -705,12 +3228,133 @@ int main(void)
 
         if (db_config.count("MAX_CACHE_SIZE"))
             MAX_CACHE_SIZE = stoi(db_config.at("MAX_CACHE_SIZE"));
+        if (db_config.count("MAX_CACHE_BYTES"))
+            MAX_CACHE_BYTES = stoull(db_config.at("MAX_CACHE_BYTES"));
+        if (db_config.count("MAX_ITEM_BYTES"))
+            MAX_ITEM_BYTES = stoull(db_config.at("MAX_ITEM_BYTES"));
+        if (db_config.count("SLAB_PAGE_BYTES"))
+            SLAB_PAGE_BYTES = stoull(db_config.at("SLAB_PAGE_BYTES"));
+        if (db_config.count("SLAB_GROWTH_FACTOR"))
+            SLAB_GROWTH_FACTOR = stod(db_config.at("SLAB_GROWTH_FACTOR"));
+        if (db_config.count("SHARED_VALUE_BYTES"))
+            SHARED_VALUE_BYTES = stoull(db_config.at("SHARED_VALUE_BYTES"));
+        // The index is preallocated per entry, so a byte budget alone still needs
+        // an entry ceiling; assume an average entry of about 1 KB.
+        if (MAX_CACHE_BYTES > 0 && !db_config.count("MAX_CACHE_SIZE"))
+            MAX_CACHE_SIZE = MAX_CACHE_BYTES / 1024;
         if (db_config.count("DB_POOL_SIZE"))
             DB_POOL_SIZE = stoi(db_config.at("DB_POOL_SIZE"));
+        if (db_config.count("DB_HEALTH_CHECK_MS"))
+            DB_HEALTH_CHECK_MS = stoll(db_config.at("DB_HEALTH_CHECK_MS"));
         if (db_config.count("SERVER_PORT"))
             SERVER_PORT = stoi(db_config.at("SERVER_PORT"));
+        if (db_config.count("CACHE_SHARDS"))
+            CACHE_SHARDS = stoi(db_config.at("CACHE_SHARDS"));
+        if (db_config.count("CACHE_POLICY"))
+            CACHE_POLICY = parse_eviction_policy(db_config.at("CACHE_POLICY"));
+        if (db_config.count("CACHE_LOCKING"))
+        {
+            string locking = db_config.at("CACHE_LOCKING");
+            if (locking == "rwlock")
+                CACHE_LOCKING = LockingPolicy::RWLOCK;
+            else if (locking == "mutex")
+                CACHE_LOCKING = LockingPolicy::MUTEX;
+            else if (locking == "rcu")
+                CACHE_LOCKING = LockingPolicy::RCU;
+            else
+                throw runtime_error("Unknown CACHE_LOCKING '" + locking + "' (expected rwlock, mutex or rcu)");
+        }
+        if (db_config.count("CACHE_ADMISSION"))
+        {
+            string admission = db_config.at("CACHE_ADMISSION");
+            if (admission == "tinylfu")
+                CACHE_ADMISSION = AdmissionPolicy::TINYLFU;
+            else if (admission == "none")
+                CACHE_ADMISSION = AdmissionPolicy::NONE;
+            else
+                throw runtime_error("Unknown CACHE_ADMISSION '" + admission + "' (expected none or tinylfu)");
+        }
 
-        cout << "CONFIG: host=" << db_host << " user=" << db_user << " schema=" << db_name << " pool=" << DB_POOL_SIZE << " cache=" << MAX_CACHE_SIZE << endl;
+        if (db_config.count("NEGATIVE_CACHE_SIZE"))
+            NEGATIVE_CACHE_SIZE = stoull(db_config.at("NEGATIVE_CACHE_SIZE"));
+        if (db_config.count("NEGATIVE_CACHE_TTL_MS"))
+            NEGATIVE_CACHE_TTL_MS = stoll(db_config.at("NEGATIVE_CACHE_TTL_MS"));
+        if (db_config.count("COALESCE_MISSES"))
+            COALESCE_MISSES = stoi(db_config.at("COALESCE_MISSES")) != 0;
+        if (db_config.count("HOT_REPLICA_THRESHOLD"))
+            HOT_REPLICA_THRESHOLD = stoull(db_config.at("HOT_REPLICA_THRESHOLD"));
+        if (db_config.count("HOT_REPLICA_CAPACITY"))
+            HOT_REPLICA_CAPACITY = stoull(db_config.at("HOT_REPLICA_CAPACITY"));
+        if (db_config.count("CACHE_TTL_MS"))
+            CACHE_TTL_MS = stoll(db_config.at("CACHE_TTL_MS"));
+        if (db_config.count("REFRESH_AHEAD_PERCENT"))
+            REFRESH_AHEAD_PERCENT = min(100, max(0, stoi(db_config.at("REFRESH_AHEAD_PERCENT"))));
+        if (db_config.count("STALE_SERVE_MS"))
+            STALE_SERVE_MS = max(0LL, stoll(db_config.at("STALE_SERVE_MS")));
+        if (db_config.count("COMPRESS_MIN_BYTES"))
+            COMPRESS_MIN_BYTES = stoull(db_config.at("COMPRESS_MIN_BYTES"));
+        if (db_config.count("COMPRESS_LEVEL"))
+            COMPRESS_LEVEL = min(9, max(1, stoi(db_config.at("COMPRESS_LEVEL"))));
+        if (db_config.count("MEMORY_LIMIT_BYTES"))
+            MEMORY_LIMIT_BYTES = stoull(db_config.at("MEMORY_LIMIT_BYTES"));
+        if (db_config.count("GOVERNOR_INTERVAL_MS"))
+            GOVERNOR_INTERVAL_MS = max(10LL, stoll(db_config.at("GOVERNOR_INTERVAL_MS")));
+        if (db_config.count("WRITE_BACK"))
+            WRITE_BACK = stoi(db_config.at("WRITE_BACK")) != 0;
+        if (db_config.count("WRITE_BACK_QUEUE_LIMIT"))
+            WRITE_BACK_QUEUE_LIMIT = max<size_t>(1, stoull(db_config.at("WRITE_BACK_QUEUE_LIMIT")));
+        if (db_config.count("WRITE_BACK_THREADS"))
+            WRITE_BACK_THREADS = max(1, stoi(db_config.at("WRITE_BACK_THREADS")));
+        if (db_config.count("WRITE_BACK_DRAIN_S"))
+            WRITE_BACK_DRAIN_S = max(0LL, stoll(db_config.at("WRITE_BACK_DRAIN_S")));
+        if (db_config.count("GROUP_COMMIT_WINDOW_US"))
+            GROUP_COMMIT_WINDOW_US = max(0LL, stoll(db_config.at("GROUP_COMMIT_WINDOW_US")));
+        if (db_config.count("GROUP_COMMIT_MAX_BATCH"))
+            GROUP_COMMIT_MAX_BATCH = max<size_t>(1, stoull(db_config.at("GROUP_COMMIT_MAX_BATCH")));
+        if (db_config.count("READ_BATCH_WINDOW_US"))
+            READ_BATCH_WINDOW_US = max(0LL, stoll(db_config.at("READ_BATCH_WINDOW_US")));
+        if (db_config.count("READ_BATCH_MAX"))
+            READ_BATCH_MAX = max<size_t>(1, stoull(db_config.at("READ_BATCH_MAX")));
+        if (db_config.count("TTL_SWEEP_INTERVAL_MS"))
+            TTL_SWEEP_INTERVAL_MS = stoll(db_config.at("TTL_SWEEP_INTERVAL_MS"));
+        if (db_config.count("TTL_DELETE_BATCH"))
+            TTL_DELETE_BATCH = max(1, stoi(db_config.at("TTL_DELETE_BATCH")));
+        if (db_config.count("TOMBSTONE_TTL_MS"))
+            TOMBSTONE_TTL_MS = max(0LL, stoll(db_config.at("TOMBSTONE_TTL_MS")));
+        if (db_config.count("WARMUP"))
+        {
+            string mode = db_config.at("WARMUP");
+            if (mode == "recent")
+                WARMUP_MODE = WarmupMode::RECENT;
+            else if (mode == "hotkeys")
+                WARMUP_MODE = WarmupMode::HOT_KEYS;
+            else if (mode == "off")
+                WARMUP_MODE = WarmupMode::OFF;
+            else
+                throw runtime_error("Unknown WARMUP '" + mode + "' (expected off, recent or hotkeys)");
+        }
+        if (db_config.count("WARMUP_THREADS"))
+            WARMUP_THREADS = stoi(db_config.at("WARMUP_THREADS"));
+        if (db_config.count("WARMUP_ASYNC"))
+            WARMUP_ASYNC = stoi(db_config.at("WARMUP_ASYNC")) != 0;
+        if (db_config.count("HOT_KEYS_FILE"))
+            HOT_KEYS_FILE = db_config.at("HOT_KEYS_FILE");
+        if (db_config.count("HOT_KEYS_SAVE_INTERVAL_S"))
+            HOT_KEYS_SAVE_INTERVAL_S = stoll(db_config.at("HOT_KEYS_SAVE_INTERVAL_S"));
+        if (db_config.count("SNAPSHOT_FILE"))
+            SNAPSHOT_FILE = db_config.at("SNAPSHOT_FILE");
+        if (db_config.count("SNAPSHOT_INTERVAL_S"))
+            SNAPSHOT_INTERVAL_S = stoll(db_config.at("SNAPSHOT_INTERVAL_S"));
+        if (db_config.count("SNAPSHOT_MAX_AGE_S"))
+            SNAPSHOT_MAX_AGE_S = stoll(db_config.at("SNAPSHOT_MAX_AGE_S"));
+        if (WARMUP_MODE == WarmupMode::HOT_KEYS && HOT_KEYS_FILE.empty())
+            throw runtime_error("WARMUP=hotkeys needs HOT_KEYS_FILE");
+
+        init_cache();
+        negative_cache.reset(new NegativeCache(NEGATIVE_CACHE_SIZE, chrono::milliseconds(NEGATIVE_CACHE_TTL_MS), CACHE_SHARDS));
+        hot_replicas.reset(new HotKeyReplicas(HOT_REPLICA_THRESHOLD, HOT_REPLICA_CAPACITY));
+
+        cout << "CONFIG: host=" << db_host << " user=" << db_user << " schema=" << db_name << " pool=" << DB_POOL_SIZE << " cache=" << MAX_CACHE_SIZE << " cache_bytes=" << MAX_CACHE_BYTES << " shards=" << CACHE_SHARDS << endl;
 
         // initialize the driver once
         driver_instance = get_driver_instance();
@@ -718,7 +3362,15 @@ int main(void)
         // Initialize connection pool (this will create DB_POOL_SIZE connections)
         db_pool.init(db_host, db_user, db_pass, db_name, DB_POOL_SIZE);
 
-        // Optional: pre-warm cache from DB or via other mechanism if desired (not done automatically)
+        ttl_supported = ensure_ttl_column();
+        recency_supported = ensure_updated_at_column();
+        flags_supported = ensure_flags_column();
+        version_supported = ensure_version_column();
+        tombstones_supported = ttl_supported && version_supported;
+        compression_supported = COMPRESS_MIN_BYTES > 0 && flags_supported && ensure_binary_value_column();
+        if (COMPRESS_MIN_BYTES > 0 && !compression_supported)
+            cerr << "[SCHEMA] kv_pairs cannot hold compressed values, COMPRESS_MIN_BYTES ignored" << endl;
+        db_pool.start_health_checks(DB_HEALTH_CHECK_MS);
     }
     catch (const exception &e)
     {
@@ -726,8 +3378,46 @@ int main(void)
         return 1;
     }
 
+    // A usable snapshot replaces the warm-up from MySQL
+    bool restoring = !SNAPSHOT_FILE.empty() && open_snapshot();
+    if (restoring)
+        start_background(restore_snapshot);
+    else if (WARMUP_MODE != WarmupMode::OFF)
+    {
+        if (WARMUP_ASYNC)
+            start_background(run_warmup);
+        else
+            run_warmup();
+    }
+    if (!HOT_KEYS_FILE.empty() && HOT_KEYS_SAVE_INTERVAL_S > 0)
+        start_background(hot_keys_loop);
+
+    if (!SNAPSHOT_FILE.empty() && SNAPSHOT_INTERVAL_S > 0)
+        start_background(snapshot_loop);
+
+    start_background(expiry_loop);
+
+    if (CACHE_TTL_MS > 0)
+        start_background(refresh_loop);
+
+    if (WRITE_BACK)
+        for (int i = 0; i < WRITE_BACK_THREADS; ++i)
+            start_background(write_back_loop);
+
+    if (MEMORY_LIMIT_BYTES > 0)
+        start_background(governor_loop);
+
     httplib::Server svr;
 
+    thread([&svr, stop_signals]()
+           {
+        int sig = 0;
+        sigwait(&stop_signals, &sig);
+        cout << "Received signal " << sig << ", shutting down" << endl;
+        svr.wait_until_ready();
+        svr.stop(); })
+        .detach();
+
     svr.Post("/kv", [&](const httplib::Request &req, httplib::Response &res)
              { create_key_handler(req, res); });
     svr.Get("/kv", [&](const httplib::Request &req, httplib::Response &res)
@@ -739,16 +3429,20 @@ int main(void)
     svr.Get("/stats", [&](const httplib::Request &req, httplib::Response &res)
             { stats_handler(req, res); });
 
-    cout << "Server with " << MAX_CACHE_SIZE << "-item LRU cache and DB pool size " << DB_POOL_SIZE << ". Starting on port " << SERVER_PORT << endl;
+    cout << "Server with " << MAX_CACHE_SIZE << "-item " << with_cache([](auto &cache)
+                                                                         { return cache.policy_name(); })
+         << " cache (" << CACHE_SHARDS << " shards) and DB pool size " << DB_POOL_SIZE << ". Starting on port " << SERVER_PORT << endl;
 
     if (!svr.listen("0.0.0.0", SERVER_PORT))
     {
         cerr << "\nFATAL ERROR: Server failed to listen on 0.0.0.0:" << SERVER_PORT << endl;
         cerr << "This is most likely a port conflict. Check with 'sudo lsof -i :" << SERVER_PORT << "'" << endl;
+        // Nothing was served; keep the existing snapshot
+        shut_down(false);
         return 1;
     }
 
-    // cleanup (never reached normally)
-    db_pool.cleanup();
+    // Stopped by a signal; no request is in flight any more
+    shut_down(true);
     return 0;
 }
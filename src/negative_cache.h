@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// -------------------- Negative cache (tombstones) --------------------
+// Remembers keys that are known to be absent from kv_pairs so repeated GETs
+// of missing or deleted keys are answered without a SELECT. Tombstones have
+// their own entry limit and TTL and are kept apart from the value cache so
+// they never displace real entries.
+//
+// Writers must call erase() after the key is written to the database.
+// Tombstones recorded from a database read use a fill token: token() is taken
+// before the read and put() drops the tombstone if any erase() hit the same
+// shard in between, so a racing write is never hidden by a stale tombstone.
+class NegativeCache
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    NegativeCache(size_t max_entries, std::chrono::milliseconds ttl, size_t num_shards) : ttl_(ttl)
+    {
+        if (num_shards == 0)
+            num_shards = 1;
+        if (max_entries > 0 && num_shards > max_entries)
+            num_shards = max_entries;
+        for (size_t i = 0; i < num_shards; ++i)
+        {
+            std::unique_ptr<Shard> shard(new Shard());
+            shard->capacity = max_entries / num_shards + (i < max_entries % num_shards ? 1 : 0);
+            shards_.push_back(std::move(shard));
+        }
+        capacity_ = max_entries;
+    }
+
+    bool enabled() const { return capacity_ > 0; }
+    size_t capacity() const { return capacity_; }
+    std::chrono::milliseconds ttl() const { return ttl_; }
+
+    uint64_t token(const std::string &key)
+    {
+        Shard &shard = shard_for(key);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        return shard.epoch;
+    }
+
+    // True if a live tombstone exists for key
+    bool contains(const std::string &key)
+    {
+        if (!enabled())
+            return false;
+        Shard &shard = shard_for(key);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        auto it = shard.expiry.find(key);
+        if (it == shard.expiry.end())
+            return false;
+        if (it->second <= clock::now())
+        {
+            shard.expiry.erase(it);
+            return false;
+        }
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Record that key is absent, unless the shard saw a write since token
+    void put(const std::string &key, uint64_t fill_token)
+    {
+        if (!enabled())
+            return;
+        Shard &shard = shard_for(key);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        if (shard.epoch != fill_token || shard.capacity == 0)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        clock::time_point expires = clock::now() + ttl_;
+        shard.expiry[key] = expires;
+        shard.fifo.push_back({key, expires});
+
+        // Oldest tombstones go first once the shard is over its limit
+        while (shard.expiry.size() > shard.capacity && !shard.fifo.empty())
+            pop_oldest(shard);
+        if (shard.fifo.size() > 2 * shard.capacity + 16)
+            compact(shard);
+    }
+
+    // The key was written: drop its tombstone and invalidate in-flight fills
+    void erase(const std::string &key)
+    {
+        if (!enabled())
+            return;
+        Shard &shard = shard_for(key);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        shard.epoch++;
+        shard.expiry.erase(key);
+    }
+
+    size_t size()
+    {
+        size_t total = 0;
+        for (auto &shard : shards_)
+        {
+            std::lock_guard<std::mutex> lk(shard->mutex);
+            total += shard->expiry.size();
+        }
+        return total;
+    }
+
+    long long hits() const { return hits_.load(); }
+    long long dropped() const { return dropped_.load(); }
+
+private:
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, clock::time_point> expiry;
+        std::deque<std::pair<std::string, clock::time_point>> fifo; // insertion order, may hold stale records
+        uint64_t epoch = 0;
+        size_t capacity = 0;
+    };
+
+    Shard &shard_for(const std::string &key)
+    {
+        return *shards_[(std::hash<std::string>{}(key) >> 32) % shards_.size()];
+    }
+
+    static void pop_oldest(Shard &shard)
+    {
+        auto &oldest = shard.fifo.front();
+        auto it = shard.expiry.find(oldest.first);
+        if (it != shard.expiry.end() && it->second == oldest.second)
+            shard.expiry.erase(it);
+        shard.fifo.pop_front();
+    }
+
+    static void compact(Shard &shard)
+    {
+        std::deque<std::pair<std::string, clock::time_point>> kept;
+        for (auto &rec : shard.fifo)
+        {
+            auto it = shard.expiry.find(rec.first);
+            if (it != shard.expiry.end() && it->second == rec.second)
+                kept.push_back(std::move(rec));
+        }
+        shard.fifo.swap(kept);
+    }
+
+    std::chrono::milliseconds ttl_;
+    size_t capacity_ = 0;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<long long> hits_{0};
+    std::atomic<long long> dropped_{0};
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "epoch_reclaimer.h"
+#include "flat_cache_index.h"
+
+// -------------------- Read-copy-update index --------------------
+// A read-only view of one cache shard for lookups that take no lock. Each
+// cached key is an immutable Node; a write publishes a new Node in place of
+// the old one and retires the old one to the epoch reclaimer
+// (epoch_reclaimer.h), so a reader inside an EpochGuard may keep using
+// whatever it found.
+//
+// The table is open addressing with linear probing over atomic Node
+// pointers. Erasing leaves a tombstone so probe chains stay intact; once live
+// entries plus tombstones fill 3/4 of the table the writer builds a fresh
+// table, publishes it and retires the old one.
+//
+// find() needs an EpochGuard; publish() and remove() need the owner's write
+// lock. The owner (ShardedCache) keeps its FlatCacheIndex as the source of
+// truth and mirrors every change here.
+class RcuIndex
+{
+public:
+    using SharedValue = FlatCacheIndex::SharedValue;
+
+    struct Node
+    {
+        size_t hash = 0;
+        std::string key;
+        SharedValue shared; // large values, shared by reference count
+        std::string value;  // small values, copied out by readers
+        int64_t stored_at = 0;
+        uint64_t version = 0;
+        uint32_t cost_us = 0;
+        int64_t expires_at = 0;
+        uint8_t flags = 0;
+        uint32_t idx = 0; // the entry in the owner's FlatCacheIndex
+    };
+
+    // Fixed bytes one entry costs here beyond its key and value copies: the
+    // node and the two table slots (tables are kept at least twice the
+    // entry count) that go with it
+    static constexpr size_t kNodeOverhead = sizeof(Node) + 2 * sizeof(std::atomic<const Node *>);
+
+    explicit RcuIndex(size_t capacity) : table_(new Table(slots_for(capacity))) {}
+
+    ~RcuIndex()
+    {
+        Table *table = table_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i <= table->mask; ++i)
+        {
+            const Node *n = table->slots[i].load(std::memory_order_relaxed);
+            if (n && n != tombstone())
+                delete n;
+        }
+        delete table;
+    }
+
+    RcuIndex(const RcuIndex &) = delete;
+    RcuIndex &operator=(const RcuIndex &) = delete;
+
+    // Caller holds an EpochGuard; the node stays valid until it leaves it
+    const Node *find(std::string_view key, size_t hash) const
+    {
+        const Table *table = table_.load(std::memory_order_acquire);
+        for (size_t i = hash & table->mask;; i = (i + 1) & table->mask)
+        {
+            const Node *n = table->slots[i].load(std::memory_order_acquire);
+            if (!n)
+                return nullptr;
+            if (n != tombstone() && n->hash == hash && n->key == key)
+                return n;
+        }
+    }
+
+    // Make node the key's current version; takes ownership
+    void publish(const Node *node)
+    {
+        Table *table = table_.load(std::memory_order_relaxed);
+        size_t free_slot = npos;
+        size_t i = node->hash & table->mask;
+        for (;; i = (i + 1) & table->mask)
+        {
+            const Node *n = table->slots[i].load(std::memory_order_relaxed);
+            if (!n)
+                break;
+            if (n == tombstone())
+            {
+                if (free_slot == npos)
+                    free_slot = i;
+                continue;
+            }
+            if (n->hash == node->hash && n->key == node->key)
+            {
+                table->slots[i].store(node, std::memory_order_release);
+                retired_.retire(n);
+                return;
+            }
+        }
+        if (free_slot == npos)
+        {
+            free_slot = i;
+            table->used++;
+        }
+        table->slots[free_slot].store(node, std::memory_order_release);
+        live_++;
+        if (table->used * 4 > (table->mask + 1) * 3)
+            rebuild();
+    }
+
+    void remove(std::string_view key, size_t hash)
+    {
+        Table *table = table_.load(std::memory_order_relaxed);
+        for (size_t i = hash & table->mask;; i = (i + 1) & table->mask)
+        {
+            const Node *n = table->slots[i].load(std::memory_order_relaxed);
+            if (!n)
+                return;
+            if (n != tombstone() && n->hash == hash && n->key == key)
+            {
+                table->slots[i].store(tombstone(), std::memory_order_release);
+                retired_.retire(n);
+                live_--;
+                return;
+            }
+        }
+    }
+
+    size_t size() const { return live_; }
+    size_t retired() const { return retired_.size(); }
+
+private:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    struct Table
+    {
+        explicit Table(size_t n) : mask(n - 1), slots(new std::atomic<const Node *>[n])
+        {
+            for (size_t i = 0; i < n; ++i)
+                slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<const Node *>[]> slots;
+        size_t used = 0; // live entries plus tombstones
+    };
+
+    // Power of two with room for capacity entries at half load
+    static size_t slots_for(size_t capacity)
+    {
+        size_t n = 16;
+        while (n < 2 * capacity)
+            n <<= 1;
+        return n;
+    }
+
+    static const Node *tombstone()
+    {
+        static const Node t;
+        return &t;
+    }
+
+    void rebuild()
+    {
+        Table *old = table_.load(std::memory_order_relaxed);
+        Table *table = new Table(slots_for(live_));
+        for (size_t i = 0; i <= old->mask; ++i)
+        {
+            const Node *n = old->slots[i].load(std::memory_order_relaxed);
+            if (!n || n == tombstone())
+                continue;
+            size_t j = n->hash & table->mask;
+            while (table->slots[j].load(std::memory_order_relaxed))
+                j = (j + 1) & table->mask;
+            table->slots[j].store(n, std::memory_order_relaxed);
+            table->used++;
+        }
+        table_.store(table, std::memory_order_release);
+        retired_.retire(old);
+    }
+
+    std::atomic<Table *> table_;
+    size_t live_ = 0;
+    RetireList retired_;
+};
@@ -0,0 +1,976 @@
+#pragma once
+
+#include "flat_cache_index.h"
+#include "frequency_sketch.h"
+#include "eviction_policies.h"
+#include "timer_wheel.h"
+#include "epoch_reclaimer.h"
+#include "rcu_index.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// -------------------- Sharded cache --------------------
+// Keys are spread over independent shards by hash. Each shard has its own
+// FlatCacheIndex, its own eviction policy state, its own slice of the item
+// and byte budgets and its own lock, so requests for keys in different shards
+// never contend.
+//
+// The eviction policy (eviction_policies.h) and the locking policy (below) are
+// template parameters: the server picks one instantiation at startup and the
+// request path has no virtual calls.
+//
+// Keys and values are stored in each shard's SlabAllocator (slab_allocator.h).
+// get() hands values out as SharedValue: large values are shared with the
+// cache by reference count, so the shard lock is held only for a refcount
+// increment; small ones are copied.
+// With a byte budget each entry is charged FlatCacheIndex::entry_bytes()
+// (with RcuLocking that includes its RcuIndex copy) and shards evict until a
+// new entry fits; the item capacity still bounds the
+// entry count because it sizes the index. Entries above the per-item cap (or a
+// whole shard's budget) are never cached.
+//
+// With TinyLFU admission every lookup and write is recorded in the shard's
+// count-min sketch, and a new key that would force an eviction is admitted
+// only if its estimated frequency beats the victim's.
+//
+// Every value is stored with a flags byte that the cache keeps but does not
+// interpret (the server uses it for the value's encoding).
+//
+// Entries may carry an absolute expiry time (unix ms). An expired entry is
+// never returned: a lookup that finds one removes it, and expire() removes
+// expired entries in batches using a per-shard timing wheel, so expiry never
+// scans the cache.
+//
+// The byte budget can be changed at runtime with set_byte_capacity(); a lower
+// budget is enforced by trim(), which evicts in bounded batches so a caller
+// off the request path can shrink the cache without holding a shard lock for
+// long.
+//
+// With max_age_ms every entry also ages out that long after its value was
+// written, whatever its own expiry. get() reports when an entry was written so
+// the caller can decide how fresh a hit is, and refresh() replaces a value
+// only if nobody has written the key since the caller read it.
+//
+// Every value may also carry its fetch cost in microseconds (0 = unknown),
+// which cost-aware policies (GdsfPolicy) weigh against its size and which
+// get() reports so the caller can account the time a hit saved.
+//
+// Writes may carry a version from a clock that only moves forward (0 =
+// unversioned). Each shard remembers, per stripe of kVersionStripes keys,
+// the highest version put or erased there, and drops a versioned put that is
+// older, so of two racing writes to a key the newer one stays cached
+// whichever reaches the cache last. fill_miss() installs a value read from
+// the database only if no versioned write or erase reached the key's stripe
+// since version_floor() was taken before the read, so a miss never puts back
+// a value that a racing write or delete replaced. A put dropped only because
+// another key moved the stripe's floor also removes the key's older entry.
+// Dropping is always safe (the next read misses), so sharing a stripe only
+// costs the odd extra miss.
+//
+// With RcuLocking, get() takes no lock at all: every shard mirrors its
+// entries into an RcuIndex (rcu_index.h) that readers walk under an
+// EpochGuard. Writers still serialise on the shard mutex, publish each change
+// to the RcuIndex and retire what they replace. Readers keep recency
+// approximate: each thread logs its lookups in its own HitLog and replays a
+// full log into the eviction policies and the TinyLFU sketch under try_lock,
+// dropping the batch for a shard whose lock is busy. Hit and miss counters are added from the same
+// logs, so /stats lags by up to kHitLogSize lookups per thread.
+
+// Locking policies. Hits take read_lock only when the eviction policy allows
+// it (kSharedHits); everything else takes write_lock. kLockFreeReads = hits
+// take no lock (see above).
+struct MutexLocking
+{
+    static constexpr const char *kName = "mutex";
+    static constexpr bool kLockFreeReads = false;
+    using mutex_type = std::mutex;
+    using read_lock = std::unique_lock<std::mutex>;
+    using write_lock = std::unique_lock<std::mutex>;
+};
+
+struct RwLocking
+{
+    static constexpr const char *kName = "rwlock";
+    static constexpr bool kLockFreeReads = false;
+    using mutex_type = std::shared_mutex;
+    using read_lock = std::shared_lock<std::shared_mutex>;
+    using write_lock = std::unique_lock<std::shared_mutex>;
+};
+
+struct RcuLocking
+{
+    static constexpr const char *kName = "rcu";
+    static constexpr bool kLockFreeReads = true;
+    using mutex_type = std::mutex;
+    using read_lock = std::unique_lock<std::mutex>;
+    using write_lock = std::unique_lock<std::mutex>;
+};
+
+struct CacheConfig
+{
+    size_t max_items = 0;      // total entries across shards
+    size_t max_bytes = 0;      // 0 = no byte budget
+    size_t max_item_bytes = 0; // 0 = no per-item cap
+    size_t shards = 1;
+    bool tinylfu = false;
+    bool log_events = false; // print stores/evictions to stdout
+    int64_t expiry_tick_ms = 100; // timing wheel resolution
+    int64_t max_age_ms = 0;       // entries are dropped this long after they were written; 0 = never
+    size_t slab_page_bytes = SlabAllocator::kDefaultPageBytes;
+    double slab_growth_factor = SlabAllocator::kDefaultGrowthFactor;
+    size_t shared_value_bytes = FlatCacheIndex::kDefaultSharedValueBytes; // values this large are refcounted
+};
+
+struct CacheShardStats
+{
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t bytes = 0;
+    size_t byte_capacity = 0;
+    long long hits = 0;
+    long long misses = 0;
+};
+
+struct CacheStats
+{
+    size_t size = 0;
+    size_t bytes = 0;
+    long long hits = 0;
+    long long misses = 0;
+    long long admitted = 0;
+    long long rejected_admission = 0;
+    long long rejected_oversize = 0;
+    long long expired = 0;
+    long long stale_writes = 0; // versioned puts and fills dropped as older than a racing write
+    size_t pending_timers = 0;
+    SlabAllocator::Stats slab; // summed over shards; classes merged by chunk size
+    std::vector<CacheShardStats> shards;
+};
+
+using SharedValue = FlatCacheIndex::SharedValue;
+
+// Reported by ShardedCache::get() on a hit
+struct EntryInfo
+{
+    int64_t stored_at = 0;  // unix ms the value was written
+    int64_t expires_at = 0; // the key's own deadline, 0 = none
+    uint8_t flags = 0;      // as given with the value
+    uint64_t version = 0;   // as given with the value, 0 = unversioned
+    uint32_t cost_us = 0;   // as given with the value, 0 = unknown
+};
+
+template <typename Eviction, typename Locking>
+class ShardedCache
+{
+public:
+    static constexpr size_t kHitLogSize = 64; // lookups a reader logs before replaying them (RcuLocking)
+    static constexpr size_t kVersionStripes = 1024; // per shard
+
+    explicit ShardedCache(const CacheConfig &config) : config_(config)
+    {
+        size_t num_shards = config.shards == 0 ? 1 : config.shards;
+        // a shard with zero capacity could never hold anything
+        if (config.max_items > 0 && num_shards > config.max_items)
+            num_shards = config.max_items;
+
+        // remainders go to the first shards
+        for (size_t i = 0; i < num_shards; ++i)
+        {
+            size_t capacity = config.max_items / num_shards + (i < config.max_items % num_shards ? 1 : 0);
+            size_t byte_capacity = config.max_bytes / num_shards + (i < config.max_bytes % num_shards ? 1 : 0);
+            shards_.emplace_back(new Shard(capacity, byte_capacity, config));
+        }
+        byte_capacity_.store(config.max_bytes, std::memory_order_relaxed);
+        if constexpr (Locking::kLockFreeReads)
+            hit_logs_.reset(new HitLog[EpochGuard::kMaxThreads]);
+    }
+
+    ShardedCache(const ShardedCache &) = delete;
+    ShardedCache &operator=(const ShardedCache &) = delete;
+
+    static const char *policy_name() { return Eviction::kName; }
+    static const char *locking_name() { return Locking::kName; }
+    size_t shard_count() const { return shards_.size(); }
+
+    // info, if given, receives the entry's write time, deadline and flags on a hit
+    bool get(const std::string &key, SharedValue &out_value, EntryInfo *info = nullptr)
+    {
+        size_t hash = std::hash<std::string>{}(key);
+        Shard &shard = shard_for(hash);
+        // RcuLocking records lookups in the sketch when it replays its HitLog
+        if (shard.sketch && !Locking::kLockFreeReads)
+            shard.sketch->record(hash);
+
+        if constexpr (Locking::kLockFreeReads)
+        {
+            EpochGuard guard;
+            if (guard.active())
+            {
+                Lookup result = lookup_published(shard, key, hash, out_value, info, guard.slot());
+                if (result == Lookup::EXPIRED)
+                {
+                    typename Locking::write_lock lk(shard.mutex);
+                    remove_if_expired(shard, key, hash);
+                }
+                return result == Lookup::HIT;
+            }
+            // No epoch slot left for this thread: take the locked path
+            if (shard.sketch)
+                shard.sketch->record(hash);
+        }
+
+        Lookup result;
+        std::string copy; // small values are copied here under the lock
+        out_value.reset();
+        if constexpr (Eviction::kSharedHits)
+        {
+            {
+                typename Locking::read_lock lk(shard.mutex);
+                result = lookup(shard, key, hash, out_value, copy, info);
+            }
+            if (result == Lookup::EXPIRED)
+            {
+                typename Locking::write_lock lk(shard.mutex);
+                remove_if_expired(shard, key, hash);
+            }
+        }
+        else
+        {
+            typename Locking::write_lock lk(shard.mutex);
+            result = lookup(shard, key, hash, out_value, copy, info);
+            if (result == Lookup::EXPIRED)
+                remove_if_expired(shard, key, hash);
+        }
+
+        bool hit = result == Lookup::HIT;
+        if (hit && !out_value)
+            out_value = std::make_shared<const std::string>(std::move(copy));
+        (hit ? shard.hits : shard.misses).fetch_add(1, std::memory_order_relaxed);
+        return hit;
+    }
+
+    // count_access=false when the put only fills a miss that get() already recorded.
+    // expires_at is an absolute unix-ms deadline, 0 for no expiry.
+    // A put with a version older than one already put or erased in the key's
+    // stripe is dropped; returns false then.
+    bool put(const std::string &key, const std::string &value, bool count_access = true, int64_t expires_at = 0,
+             uint8_t flags = 0, uint64_t version = 0, uint32_t cost_us = 0)
+    {
+        return put_value(key, value, nullptr, count_access, expires_at, flags, version, cost_us);
+    }
+
+    // Same, but a large value keeps the caller's buffer instead of a copy
+    bool put(const std::string &key, const SharedValue &value, bool count_access = true, int64_t expires_at = 0,
+             uint8_t flags = 0, uint64_t version = 0, uint32_t cost_us = 0)
+    {
+        return put_value(key, *value, value, count_access, expires_at, flags, version, cost_us);
+    }
+
+    // Highest version put or erased so far in key's stripe; take it before
+    // reading the database for a miss and pass it to fill_miss()
+    uint64_t version_floor(const std::string &key)
+    {
+        size_t hash = std::hash<std::string>{}(key);
+        Shard &shard = shard_for(hash);
+        typename Locking::read_lock lk(shard.mutex);
+        return shard.version_floors[hash % kVersionStripes];
+    }
+
+    // Every stripe's version floor, shard after shard; take it before a bulk
+    // read of the database and pass it to fill()
+    std::vector<uint64_t> version_floors()
+    {
+        std::vector<uint64_t> floors;
+        floors.reserve(shards_.size() * kVersionStripes);
+        for (auto &ptr : shards_)
+        {
+            typename Locking::read_lock lk(ptr->mutex);
+            floors.insert(floors.end(), ptr->version_floors.begin(), ptr->version_floors.end());
+        }
+        return floors;
+    }
+
+    // Cache a row read from the database for a miss (version is the row's),
+    // unless a versioned put or erase reached key's stripe since floor was
+    // taken, or the cached entry is at least as new. Returns true if stored.
+    bool fill_miss(const std::string &key, const SharedValue &value, uint64_t version, uint64_t floor,
+                   int64_t expires_at = 0, uint8_t flags = 0, uint32_t cost_us = 0)
+    {
+        size_t hash = std::hash<std::string>{}(key);
+        Shard &shard = shard_for(hash);
+        typename Locking::write_lock lk(shard.mutex);
+        if (shard.version_floors[hash % kVersionStripes] != floor)
+        {
+            stale_writes_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint32_t idx = shard.index.find(key, hash);
+        if (idx != FlatCacheIndex::npos && shard.index.at(idx).version >= version)
+            return false;
+        put_locked(shard, key, hash, idx, *value, value, expires_at, flags, version, cost_us);
+        return true;
+    }
+
+    // Insert key only if it is not cached and the shard has room without
+    // evicting. Used to preload rows read from the database: a value written
+    // since the row was read is never replaced with the older one, and
+    // preloading never displaces other entries. With floors (version_floors()
+    // taken before the read) the row is also dropped if a versioned put or
+    // erase reached key's stripe since, so a write or delete whose entry is
+    // gone is not undone either. Returns true if stored.
+    bool fill(const std::string &key, std::string_view value, int64_t expires_at = 0, uint8_t flags = 0,
+              uint64_t version = 0, const std::vector<uint64_t> *floors = nullptr)
+    {
+        size_t hash = std::hash<std::string>{}(key);
+        Shard &shard = shard_for(hash);
+        typename Locking::write_lock lk(shard.mutex);
+        size_t stripe = hash % kVersionStripes;
+        if (floors && shard.version_floors[stripe] != (*floors)[shard_index(hash) * kVersionStripes + stripe])
+        {
+            stale_writes_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        size_t entry_bytes = shard.index.entry_bytes(key.size(), value.size());
+        if (shard.capacity == 0 || shard.index.full() || !fits(shard, entry_bytes) ||
+            (shard.byte_capacity > 0 && shard.index.bytes() + entry_bytes > shard.byte_capacity))
+            return false;
+        if (shard.index.find(key, hash) != FlatCacheIndex::npos)
+            return false;
+        insert(shard, key, value, nullptr, hash, expires_at, flags, version);
+        return true;
+    }
+
+    // Replace key's value with one re-read from the database (null = the row
+    // is gone, drop the entry), but only if no write has reached the cache
+    // since the caller saw the entry: it was last written at stored_at, no
+    // versioned put or erase reached key's stripe since floor (taken before
+    // the read, as for fill_miss) and the entry is not newer than version.
+    // stored_at alone misses a write in the same millisecond. Returns true
+    // if the cache was changed.
+    bool refresh(const std::string &key, int64_t stored_at, uint64_t floor, const SharedValue &value,
+                 int64_t expires_at = 0, uint8_t flags = 0, uint64_t version = 0, uint32_t cost_us = 0)
+    {
+        size_t hash = std::hash<std::string>{}(key);
+        Shard &shard = shard_for(hash);
+        typename Locking::write_lock lk(shard.mutex);
+        uint32_t idx = shard.index.find(key, hash);
+        if (idx == FlatCacheIndex::npos || shard.index.at(idx).stored_at != stored_at)
+            return false;
+        if (shard.version_floors[hash % kVersionStripes] != floor || shard.index.at(idx).version > version)
+        {
+            stale_writes_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (!value)
+        {
+            remove(shard, idx, false);
+            return true;
+        }
+        put_locked(shard, key, hash, idx, *value, value, expires_at, flags, version, cost_us);
+        return true;
+    }
+
+    // With a version, an entry written with a newer one is kept, and puts
+    // and fills older than version are dropped from now on
+    void erase(const std::string &key, uint64_t version = 0)
+    {
+        size_t hash = std::hash<std::string>{}(key);
+        Shard &shard = shard_for(hash);
+        typename Locking::write_lock lk(shard.mutex);
+
+        uint64_t &floor = shard.version_floors[hash % kVersionStripes];
+        floor = std::max(floor, version);
+        uint32_t idx = shard.index.find(key, hash);
+        if (idx == FlatCacheIndex::npos || (version > 0 && shard.index.at(idx).version > version))
+            return;
+        remove(shard, idx, false);
+        if (config_.log_events)
+            std::cout << "[CACHE] Deleted key: " << key << std::endl;
+    }
+
+    // Remove every entry whose expiry time is at or before now_ms. Called
+    // periodically from a background thread; returns the number removed.
+    size_t expire(int64_t now_ms)
+    {
+        size_t removed = 0;
+        for (auto &ptr : shards_)
+        {
+            Shard &shard = *ptr;
+            typename Locking::write_lock lk(shard.mutex);
+            shard.wheel.advance(now_ms, [&](const ExpiryTimer &t)
+                                {
+                // Skip timers for entries that were evicted, replaced or re-armed
+                const FlatCacheIndex::Entry &e = shard.index.at(t.idx);
+                if (!e.occupied || e.hash != t.hash || deadline(e) != t.deadline)
+                    return;
+                if (config_.log_events)
+                    std::cout << "[CACHE EXPIRE] Expired key: " << e.key() << std::endl;
+                remove(shard, t.idx, false);
+                removed++; });
+        }
+        expired_.fetch_add(removed, std::memory_order_relaxed);
+        return removed;
+    }
+
+    // Change the total byte budget (0 = none), split across shards like
+    // CacheConfig::max_bytes. Nothing is evicted here; see trim().
+    void set_byte_capacity(size_t max_bytes)
+    {
+        size_t num_shards = shards_.size();
+        for (size_t i = 0; i < num_shards; ++i)
+        {
+            Shard &shard = *shards_[i];
+            typename Locking::write_lock lk(shard.mutex);
+            shard.byte_capacity = max_bytes / num_shards + (i < max_bytes % num_shards ? 1 : 0);
+        }
+        byte_capacity_.store(max_bytes, std::memory_order_relaxed);
+    }
+
+    size_t byte_capacity() const { return byte_capacity_.load(std::memory_order_relaxed); }
+
+    // Evict up to batch entries from each shard that is over its byte budget,
+    // taking each shard's lock once. Returns the number evicted; call again
+    // until it returns 0.
+    size_t trim(size_t batch)
+    {
+        size_t evicted = 0;
+        for (auto &ptr : shards_)
+        {
+            Shard &shard = *ptr;
+            typename Locking::write_lock lk(shard.mutex);
+            for (size_t n = 0; n < batch && shard.byte_capacity > 0 && shard.index.size() > 0 &&
+                               shard.index.bytes() > shard.byte_capacity;
+                 ++n)
+            {
+                uint32_t victim = shard.policy.victim();
+                if (config_.log_events)
+                    std::cout << "[CACHE EVICT] Evicted key: " << shard.index.at(victim).key() << std::endl;
+                remove(shard, victim, true);
+                evicted++;
+            }
+        }
+        return evicted;
+    }
+
+    // Bytes charged to all entries; cheaper than stats()
+    size_t bytes()
+    {
+        size_t total = 0;
+        for (auto &ptr : shards_)
+        {
+            typename Locking::read_lock lk(ptr->mutex);
+            total += ptr->index.bytes();
+        }
+        return total;
+    }
+
+    // Up to limit resident keys (0 = all), shard by shard
+    std::vector<std::string> keys(size_t limit = 0)
+    {
+        std::vector<std::string> out;
+        for (auto &ptr : shards_)
+        {
+            Shard &shard = *ptr;
+            typename Locking::read_lock lk(shard.mutex);
+            for (uint32_t idx = 0; idx < shard.index.capacity(); ++idx)
+            {
+                if (limit > 0 && out.size() >= limit)
+                    return out;
+                const FlatCacheIndex::Entry &e = shard.index.at(idx);
+                if (e.occupied)
+                    out.emplace_back(e.key());
+            }
+        }
+        return out;
+    }
+
+    // Call f(key, value, expires_at, flags) for every unexpired entry, shard by
+    // shard, each shard in its policy's eviction order (first to be evicted
+    // first). A shard is copied under its read lock and f runs after the lock
+    // is released; shared values are referenced rather than copied.
+    template <typename F>
+    void for_each_entry(F &&f)
+    {
+        struct Item
+        {
+            size_t key_offset;
+            size_t key_size;
+            size_t value_offset;
+            size_t value_size;
+            SharedValue shared;
+            int64_t expires_at;
+            uint8_t flags;
+        };
+        std::string buffer;
+        std::vector<Item> items;
+        for (auto &ptr : shards_)
+        {
+            Shard &shard = *ptr;
+            buffer.clear();
+            items.clear();
+            int64_t now = unix_now_ms();
+            {
+                typename Locking::read_lock lk(shard.mutex);
+                shard.policy.for_each_in_order([&](uint32_t idx)
+                                               {
+                    const FlatCacheIndex::Entry &e = shard.index.at(idx);
+                    int64_t due = deadline(e);
+                    if (due > 0 && due <= now)
+                        return;
+                    Item item{buffer.size(), e.key_size, 0, e.value_size, e.shared, e.expires_at, e.flags};
+                    buffer.append(e.key());
+                    if (!e.shared)
+                    {
+                        item.value_offset = buffer.size();
+                        buffer.append(e.value());
+                    }
+                    items.push_back(std::move(item)); });
+            }
+            for (const Item &item : items)
+            {
+                std::string_view key(buffer.data() + item.key_offset, item.key_size);
+                std::string_view value = item.shared ? std::string_view(*item.shared)
+                                                     : std::string_view(buffer.data() + item.value_offset, item.value_size);
+                f(key, value, item.expires_at, item.flags);
+            }
+        }
+    }
+
+    CacheStats stats()
+    {
+        CacheStats st;
+        st.admitted = admitted_.load();
+        st.rejected_admission = rejected_admission_.load();
+        st.rejected_oversize = rejected_oversize_.load();
+        st.expired = expired_.load();
+        st.stale_writes = stale_writes_.load();
+        for (auto &ptr : shards_)
+        {
+            Shard &shard = *ptr;
+            CacheShardStats ss;
+            {
+                typename Locking::read_lock lk(shard.mutex);
+                ss.size = shard.index.size();
+                ss.bytes = shard.index.bytes();
+                st.pending_timers += shard.wheel.size();
+                add_slab_stats(st.slab, shard.index.slab_stats());
+                ss.byte_capacity = shard.byte_capacity;
+            }
+            ss.capacity = shard.capacity;
+            ss.hits = shard.hits.load();
+            ss.misses = shard.misses.load();
+            st.size += ss.size;
+            st.bytes += ss.bytes;
+            st.hits += ss.hits;
+            st.misses += ss.misses;
+            st.shards.push_back(ss);
+        }
+        return st;
+    }
+
+private:
+    enum class Lookup
+    {
+        HIT,
+        MISS,
+        EXPIRED
+    };
+
+    struct ExpiryTimer
+    {
+        uint32_t idx;
+        size_t hash;
+        int64_t deadline;
+    };
+
+    struct Shard
+    {
+        Shard(size_t cap, size_t byte_cap, const CacheConfig &config)
+            : index(static_cast<uint32_t>(cap), config.slab_page_bytes, config.slab_growth_factor, config.shared_value_bytes,
+                    Locking::kLockFreeReads ? RcuIndex::kNodeOverhead : 0),
+              policy(index, cap),
+              wheel(unix_now_ms(), config.expiry_tick_ms), capacity(cap), byte_capacity(byte_cap)
+        {
+            if (config.tinylfu)
+                sketch.reset(new FrequencySketch(cap));
+            if constexpr (Locking::kLockFreeReads)
+                published.reset(new RcuIndex(cap));
+        }
+
+        FlatCacheIndex index;
+        Eviction policy;
+        TimerWheel<ExpiryTimer> wheel;
+        std::unique_ptr<FrequencySketch> sketch;
+        std::unique_ptr<RcuIndex> published; // RcuLocking only
+        std::vector<uint64_t> version_floors = std::vector<uint64_t>(kVersionStripes, 0);
+        typename Locking::mutex_type mutex;
+        size_t capacity;
+        size_t byte_capacity; // 0 = unlimited; changed only under the write lock
+
+        std::atomic<long long> hits{0};
+        std::atomic<long long> misses{0};
+    };
+
+    // The high half of the hash picks the shard; the low bits are used inside
+    // the shard's table, so the two choices stay independent.
+    size_t shard_index(size_t hash) const { return (hash >> 32) % shards_.size(); }
+    Shard &shard_for(size_t hash) { return *shards_[shard_index(hash)]; }
+
+    // One reader thread's recent lock-free lookups; idx is npos for a miss
+    struct alignas(64) HitLog
+    {
+        struct Record
+        {
+            uint32_t shard;
+            uint32_t idx;
+            size_t hash;
+        };
+        std::array<Record, kHitLogSize> records;
+        size_t count = 0;
+    };
+
+    // A hit fills out_value for a shared value, or copy for an inline one
+    Lookup lookup(Shard &shard, const std::string &key, size_t hash, SharedValue &out_value, std::string &copy,
+                  EntryInfo *info)
+    {
+        uint32_t idx = shard.index.find(key, hash);
+        if (idx == FlatCacheIndex::npos)
+            return Lookup::MISS;
+        const FlatCacheIndex::Entry &e = shard.index.at(idx);
+        int64_t due = deadline(e);
+        if (due > 0 && due <= unix_now_ms())
+            return Lookup::EXPIRED;
+        if (e.shared)
+            out_value = e.shared;
+        else
+            copy.assign(e.value());
+        if (info)
+        {
+            info->stored_at = e.stored_at;
+            info->expires_at = e.expires_at;
+            info->flags = e.flags;
+            info->version = e.version;
+            info->cost_us = e.cost_us;
+        }
+        shard.policy.on_hit(idx);
+        return Lookup::HIT;
+    }
+
+    // get() for RcuLocking; caller holds an EpochGuard on slot
+    Lookup lookup_published(Shard &shard, const std::string &key, size_t hash, SharedValue &out_value,
+                            EntryInfo *info, size_t slot)
+    {
+        out_value.reset();
+        Lookup result = Lookup::MISS;
+        uint32_t idx = FlatCacheIndex::npos;
+        if (const RcuIndex::Node *n = shard.published->find(key, hash))
+        {
+            int64_t due = deadline(n->stored_at, n->expires_at);
+            if (due > 0 && due <= unix_now_ms())
+                result = Lookup::EXPIRED;
+            else
+            {
+                out_value = n->shared ? n->shared : std::make_shared<const std::string>(n->value);
+                if (info)
+                {
+                    info->stored_at = n->stored_at;
+                    info->expires_at = n->expires_at;
+                    info->flags = n->flags;
+                    info->version = n->version;
+                    info->cost_us = n->cost_us;
+                }
+                idx = n->idx;
+                result = Lookup::HIT;
+            }
+        }
+        HitLog &log = hit_logs_[slot];
+        log.records[log.count++] = {static_cast<uint32_t>(shard_index(hash)), idx, hash};
+        if (log.count == kHitLogSize)
+            replay(log);
+        return result;
+    }
+
+    // Add a full HitLog to the shard counters and feed its hits to the
+    // eviction policies, and all its lookups to the TinyLFU sketch. A shard
+    // whose lock is busy loses them: recency and frequency are approximate,
+    // and a reader never waits for a writer or writes shared counters per
+    // lookup.
+    void replay(HitLog &log)
+    {
+        std::sort(log.records.begin(), log.records.begin() + log.count, [](const typename HitLog::Record &a, const typename HitLog::Record &b)
+                  { return a.shard < b.shard; });
+        for (size_t i = 0; i < log.count;)
+        {
+            size_t end = i;
+            long long hits = 0;
+            while (end < log.count && log.records[end].shard == log.records[i].shard)
+                hits += log.records[end++].idx != FlatCacheIndex::npos;
+            Shard &shard = *shards_[log.records[i].shard];
+            shard.hits.fetch_add(hits, std::memory_order_relaxed);
+            shard.misses.fetch_add(static_cast<long long>(end - i) - hits, std::memory_order_relaxed);
+            typename Locking::write_lock lk(shard.mutex, std::defer_lock);
+            if ((hits > 0 || shard.sketch) && lk.try_lock())
+            {
+                for (; i < end; ++i)
+                {
+                    const typename HitLog::Record &r = log.records[i];
+                    if (shard.sketch)
+                        shard.sketch->record(r.hash);
+                    // The entry may have been replaced since; skip it then
+                    if (r.idx != FlatCacheIndex::npos && shard.index.at(r.idx).occupied &&
+                        shard.index.at(r.idx).hash == r.hash)
+                        shard.policy.on_hit(r.idx);
+                }
+            }
+            i = end;
+        }
+        log.count = 0;
+    }
+
+    bool put_value(const std::string &key, std::string_view value, const SharedValue &shared, bool count_access,
+                   int64_t expires_at, uint8_t flags, uint64_t version, uint32_t cost_us)
+    {
+        size_t hash = std::hash<std::string>{}(key);
+        Shard &shard = shard_for(hash);
+        if (shard.sketch && count_access)
+            shard.sketch->record(hash);
+
+        typename Locking::write_lock lk(shard.mutex);
+        uint32_t idx = shard.index.find(key, hash);
+        if (version > 0)
+        {
+            uint64_t &floor = shard.version_floors[hash % kVersionStripes];
+            bool older_than_entry = idx != FlatCacheIndex::npos && shard.index.at(idx).version > version;
+            if (older_than_entry || version < floor)
+            {
+                stale_writes_.fetch_add(1, std::memory_order_relaxed);
+                // Dropped because another key of the stripe moved the floor:
+                // the cached entry is older than this write and must go too
+                if (!older_than_entry && idx != FlatCacheIndex::npos && shard.index.at(idx).version < version)
+                    remove(shard, idx, false);
+                return false;
+            }
+            floor = version;
+        }
+        put_locked(shard, key, hash, idx, value, shared, expires_at, flags, version, cost_us);
+        return true;
+    }
+
+    // Caller holds the write lock; idx is the key's entry or npos
+    void put_locked(Shard &shard, const std::string &key, size_t hash, uint32_t idx, std::string_view value,
+                    const SharedValue &shared, int64_t expires_at, uint8_t flags, uint64_t version = 0,
+                    uint32_t cost_us = 0)
+    {
+        if (idx != FlatCacheIndex::npos)
+        {
+            FlatCacheIndex::Entry &e = shard.index.at(idx);
+            size_t old_bytes = shard.index.entry_bytes(e.key_size, e.value_size);
+            size_t new_bytes = shard.index.entry_bytes(key.size(), value.size());
+            bool grows_over_budget = shard.byte_capacity > 0 && new_bytes > old_bytes &&
+                                     shard.index.bytes() + (new_bytes - old_bytes) > shard.byte_capacity;
+            if (!grows_over_budget && fits(shard, new_bytes))
+            {
+                shard.index.assign(idx, value, shared);
+                e.expires_at = expires_at;
+                e.stored_at = unix_now_ms();
+                e.flags = flags;
+                e.version = version;
+                e.cost_us = cost_us;
+                schedule_expiry(shard, idx);
+                publish(shard, idx);
+                shard.policy.on_hit(idx);
+                return;
+            }
+            // The new value needs room (or cannot be cached): drop the old entry
+            // so it is never served stale, then insert like a new key.
+            remove(shard, idx, false);
+        }
+        insert(shard, key, value, shared, hash, expires_at, flags, version, cost_us);
+    }
+
+    // Caller holds the write lock
+    void remove_if_expired(Shard &shard, const std::string &key, size_t hash)
+    {
+        uint32_t idx = shard.index.find(key, hash);
+        if (idx == FlatCacheIndex::npos)
+            return;
+        int64_t due = deadline(shard.index.at(idx));
+        if (due == 0 || due > unix_now_ms())
+            return;
+        remove(shard, idx, false);
+        expired_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // When the entry stops being served: its own expiry or the end of its
+    // max age, whichever comes first; 0 = never
+    int64_t deadline(const FlatCacheIndex::Entry &e) const { return deadline(e.stored_at, e.expires_at); }
+
+    int64_t deadline(int64_t stored_at, int64_t expires_at) const
+    {
+        if (config_.max_age_ms <= 0)
+            return expires_at;
+        int64_t aged = stored_at + config_.max_age_ms;
+        return expires_at > 0 ? std::min(expires_at, aged) : aged;
+    }
+
+    // Caller holds the write lock; shows idx's current contents to lock-free
+    // readers (RcuLocking)
+    void publish(Shard &shard, uint32_t idx)
+    {
+        if constexpr (Locking::kLockFreeReads)
+        {
+            const FlatCacheIndex::Entry &e = shard.index.at(idx);
+            RcuIndex::Node *n = new RcuIndex::Node;
+            n->hash = e.hash;
+            n->key.assign(e.key());
+            if (e.shared)
+                n->shared = e.shared;
+            else
+                n->value.assign(e.value());
+            n->stored_at = e.stored_at;
+            n->expires_at = e.expires_at;
+            n->flags = e.flags;
+            n->version = e.version;
+            n->cost_us = e.cost_us;
+            n->idx = idx;
+            shard.published->publish(n);
+        }
+    }
+
+    // Caller holds the write lock. evicted = removed for capacity rather than
+    // erased or expired.
+    void remove(Shard &shard, uint32_t idx, bool evicted)
+    {
+        if constexpr (Locking::kLockFreeReads)
+        {
+            const FlatCacheIndex::Entry &e = shard.index.at(idx);
+            shard.published->remove(e.key(), e.hash);
+        }
+        if (evicted)
+            shard.policy.on_evict(idx);
+        else
+            shard.policy.on_erase(idx);
+        shard.index.erase(idx);
+    }
+
+    // Caller holds the write lock
+    void schedule_expiry(Shard &shard, uint32_t idx)
+    {
+        const FlatCacheIndex::Entry &e = shard.index.at(idx);
+        int64_t due = deadline(e);
+        if (due > 0)
+            shard.wheel.schedule(due, ExpiryTimer{idx, e.hash, due});
+    }
+
+    static void add_slab_stats(SlabAllocator::Stats &total, const SlabAllocator::Stats &part)
+    {
+        total.pages += part.pages;
+        total.spare_pages += part.spare_pages;
+        total.reserved_bytes += part.reserved_bytes;
+        total.chunk_bytes += part.chunk_bytes;
+        total.requested_bytes += part.requested_bytes;
+        total.large_allocs += part.large_allocs;
+        total.large_bytes += part.large_bytes;
+        for (const SlabAllocator::ClassStats &cs : part.classes)
+        {
+            auto it = std::find_if(total.classes.begin(), total.classes.end(), [&](const SlabAllocator::ClassStats &c)
+                                   { return c.chunk_size == cs.chunk_size; });
+            if (it == total.classes.end())
+            {
+                total.classes.insert(std::upper_bound(total.classes.begin(), total.classes.end(), cs,
+                                                      [](const SlabAllocator::ClassStats &a, const SlabAllocator::ClassStats &b)
+                                                      { return a.chunk_size < b.chunk_size; }),
+                                     cs);
+                continue;
+            }
+            it->pages += cs.pages;
+            it->chunks_used += cs.chunks_used;
+            it->chunks_free += cs.chunks_free;
+        }
+    }
+
+    // False if an entry of this size may never be cached in this shard
+    bool fits(const Shard &shard, size_t entry_bytes) const
+    {
+        if (config_.max_item_bytes > 0 && entry_bytes > config_.max_item_bytes)
+            return false;
+        if (shard.byte_capacity > 0 && entry_bytes > shard.byte_capacity)
+            return false;
+        return true;
+    }
+
+    // Evict until the shard has a free slot and entry_bytes more fit in its
+    // byte budget. With TinyLFU the candidate must first beat the frequency of
+    // the first victim; returns false (and evicts nothing) if it does not.
+    bool make_room(Shard &shard, size_t entry_bytes, size_t hash)
+    {
+        FlatCacheIndex &index = shard.index;
+        bool contested = false;
+        while (index.size() > 0 &&
+               (index.full() || (shard.byte_capacity > 0 && index.bytes() + entry_bytes > shard.byte_capacity)))
+        {
+            uint32_t victim = shard.policy.victim();
+            if (shard.sketch && !contested)
+            {
+                if (shard.sketch->estimate(hash) <= shard.sketch->estimate(index.at(victim).hash))
+                {
+                    rejected_admission_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                contested = true;
+                admitted_.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (config_.log_events)
+                std::cout << "[CACHE EVICT] Evicted key: " << index.at(victim).key() << std::endl;
+            remove(shard, victim, true);
+        }
+        return true;
+    }
+
+    void insert(Shard &shard, const std::string &key, std::string_view value, const SharedValue &shared, size_t hash,
+                int64_t expires_at, uint8_t flags = 0, uint64_t version = 0, uint32_t cost_us = 0)
+    {
+        if (shard.capacity == 0)
+            return;
+
+        size_t entry_bytes = shard.index.entry_bytes(key.size(), value.size());
+        if (!fits(shard, entry_bytes))
+        {
+            rejected_oversize_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        shard.policy.prepare_insert(hash);
+        if (!make_room(shard, entry_bytes, hash))
+            return;
+        uint32_t idx = shard.index.insert(key, value, hash, expires_at, shared);
+        shard.index.at(idx).stored_at = unix_now_ms();
+        shard.index.at(idx).flags = flags;
+        shard.index.at(idx).version = version;
+        shard.index.at(idx).cost_us = cost_us;
+        schedule_expiry(shard, idx);
+        publish(shard, idx);
+        shard.policy.on_insert(idx);
+        if (config_.log_events)
+            std::cout << "[CACHE] Stored key: " << key << std::endl;
+    }
+
+    CacheConfig config_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::unique_ptr<HitLog[]> hit_logs_; // RcuLocking: one per epoch slot, i.e. per reader thread
+
+    std::atomic<size_t> byte_capacity_{0}; // current total budget
+    std::atomic<long long> admitted_{0};
+    std::atomic<long long> rejected_admission_{0};
+    std::atomic<long long> rejected_oversize_{0};
+    std::atomic<long long> expired_{0};
+    std::atomic<long long> stale_writes_{0};
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// -------------------- Single-flight --------------------
+// Coalesces concurrent calls for the same key: the first caller (the leader)
+// runs the work, callers that arrive while it is running wait for and share
+// its result instead of repeating it. Used so a burst of misses on one key
+// costs one SELECT rather than one per request.
+//
+// forget(key) detaches a running call so later callers start a new one;
+// callers already waiting still get the detached call's result. Writers use
+// it so a read that starts after a write never joins a fetch that began
+// before it.
+template <typename Result>
+class SingleFlight
+{
+public:
+    explicit SingleFlight(size_t num_shards = 16) : shards_(num_shards == 0 ? 1 : num_shards) {}
+
+    SingleFlight(const SingleFlight &) = delete;
+    SingleFlight &operator=(const SingleFlight &) = delete;
+
+    // Run fetch() for key, or wait for the call already running for it.
+    // shared is set to true if the result came from another caller's call.
+    template <typename F>
+    Result run(const std::string &key, F &&fetch, bool &shared)
+    {
+        Shard &shard = shard_for(key);
+        std::unique_lock<std::mutex> lk(shard.mutex);
+        auto it = shard.calls.find(key);
+        if (it != shard.calls.end())
+        {
+            std::shared_future<Result> result = it->second->result;
+            lk.unlock();
+            waiters_.fetch_add(1, std::memory_order_relaxed);
+            shared = true;
+            return result.get();
+        }
+        std::shared_ptr<Call> call = std::make_shared<Call>();
+        call->result = call->promise.get_future().share();
+        shard.calls.emplace(key, call);
+        lk.unlock();
+
+        leaders_.fetch_add(1, std::memory_order_relaxed);
+        shared = false;
+        Result r;
+        try
+        {
+            r = fetch();
+        }
+        catch (...)
+        {
+            finish(shard, key, call);
+            call->promise.set_exception(std::current_exception());
+            throw;
+        }
+        finish(shard, key, call);
+        call->promise.set_value(r);
+        return r;
+    }
+
+    void forget(const std::string &key)
+    {
+        Shard &shard = shard_for(key);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        shard.calls.erase(key);
+    }
+
+    long long leaders() const { return leaders_.load(std::memory_order_relaxed); }
+    long long waiters() const { return waiters_.load(std::memory_order_relaxed); }
+
+private:
+    struct Call
+    {
+        std::promise<Result> promise;
+        std::shared_future<Result> result;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<Call>> calls;
+    };
+
+    Shard &shard_for(const std::string &key) { return shards_[std::hash<std::string>{}(key) % shards_.size()]; }
+
+    // Unregister call unless forget() already replaced or removed it
+    static void finish(Shard &shard, const std::string &key, const std::shared_ptr<Call> &call)
+    {
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        auto it = shard.calls.find(key);
+        if (it != shard.calls.end() && it->second == call)
+            shard.calls.erase(it);
+    }
+
+    std::vector<Shard> shards_;
+    std::atomic<long long> leaders_{0};
+    std::atomic<long long> waiters_{0};
+};
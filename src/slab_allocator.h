@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// -------------------- Slab allocator --------------------
+// memcached-style storage for cached keys and values, one allocator per cache
+// shard (so it shares the shard's lock and has its own free lists).
+//
+//  - Requests are rounded up to a size class. Classes start at kMinChunk and
+//    grow by growth_factor (rounded to 8 bytes) up to the page payload size.
+//  - Each class carves fixed-size chunks out of pages of page_bytes. Pages are
+//    aligned to their size so a chunk finds its page header by masking its
+//    address. Every page keeps its own free list; the class keeps a list of
+//    pages that still have a free chunk, so alloc and free are O(1).
+//  - A page whose chunks are all free is unlinked from its class and kept as
+//    a spare (up to kMaxSparePages) for any class, or returned to the heap.
+//    Memory therefore moves between classes as the value size mix changes.
+//  - Requests larger than the biggest class go straight to the heap.
+//
+// Not thread-safe; the owning shard's lock protects it.
+class SlabAllocator
+{
+public:
+    static constexpr size_t kDefaultPageBytes = 64 * 1024;
+    static constexpr double kDefaultGrowthFactor = 1.25;
+
+    struct ClassStats
+    {
+        size_t chunk_size = 0;
+        size_t pages = 0;
+        size_t chunks_used = 0;
+        size_t chunks_free = 0; // free chunks in this class's pages (carved or not)
+    };
+
+    struct Stats
+    {
+        size_t pages = 0;
+        size_t spare_pages = 0;
+        size_t reserved_bytes = 0;  // pages (including spares) + large allocations
+        size_t chunk_bytes = 0;     // chunks handed out, at their class size
+        size_t requested_bytes = 0; // bytes callers asked for
+        size_t large_allocs = 0;
+        size_t large_bytes = 0;
+        std::vector<ClassStats> classes; // only classes that own pages
+    };
+
+    explicit SlabAllocator(size_t page_bytes = kDefaultPageBytes, double growth_factor = kDefaultGrowthFactor)
+    {
+        // Power of two so a page base can be found by masking
+        page_bytes_ = 4096;
+        while (page_bytes_ < page_bytes)
+            page_bytes_ <<= 1;
+        if (growth_factor < 1.05)
+            growth_factor = 1.05;
+
+        const size_t payload = page_bytes_ - kHeaderBytes;
+        size_t size = kMinChunk;
+        while (size < payload)
+        {
+            classes_.push_back(Class{size, payload / size});
+            size_t next = static_cast<size_t>(size * growth_factor);
+            size = std::max(round8(next), size + 8);
+        }
+        classes_.push_back(Class{payload, 1});
+    }
+
+    ~SlabAllocator()
+    {
+        for (Page *page : pages_)
+            release_page(page);
+        for (Page *page : spare_)
+            release_page(page);
+    }
+
+    SlabAllocator(const SlabAllocator &) = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    // Bytes actually reserved for a request of n bytes
+    size_t chunk_size(size_t n) const
+    {
+        size_t cls = class_of(n);
+        return cls == kLarge ? n : classes_[cls].chunk_size;
+    }
+
+    void *allocate(size_t n)
+    {
+        requested_bytes_ += n;
+        size_t cls = class_of(n);
+        if (cls == kLarge)
+        {
+            large_allocs_++;
+            large_bytes_ += n;
+            return ::operator new(n);
+        }
+
+        Class &c = classes_[cls];
+        Page *page = c.partial;
+        if (!page)
+        {
+            page = new_page(static_cast<uint16_t>(cls));
+            push_partial(c, page);
+        }
+
+        void *chunk;
+        if (page->free_list)
+        {
+            chunk = page->free_list;
+            page->free_list = *static_cast<void **>(chunk);
+        }
+        else
+        {
+            chunk = reinterpret_cast<char *>(page) + kHeaderBytes + page->carved * c.chunk_size;
+            page->carved++;
+        }
+        page->live++;
+        c.live++;
+        chunk_bytes_ += c.chunk_size;
+        if (page->live == c.per_page)
+            unlink_partial(c, page);
+        return chunk;
+    }
+
+    // n must be the size passed to allocate()
+    void deallocate(void *p, size_t n)
+    {
+        if (!p)
+            return;
+        requested_bytes_ -= n;
+        size_t cls = class_of(n);
+        if (cls == kLarge)
+        {
+            large_allocs_--;
+            large_bytes_ -= n;
+            ::operator delete(p);
+            return;
+        }
+
+        Class &c = classes_[cls];
+        Page *page = page_of(p);
+        *static_cast<void **>(p) = page->free_list;
+        page->free_list = p;
+        bool was_full = page->live == c.per_page;
+        page->live--;
+        c.live--;
+        chunk_bytes_ -= c.chunk_size;
+
+        if (page->live == 0)
+        {
+            if (!was_full)
+                unlink_partial(c, page);
+            retire_page(c, page);
+        }
+        else if (was_full)
+        {
+            push_partial(c, page);
+        }
+    }
+
+    // A chunk of n bytes now holds m bytes (same size class)
+    void resize_in_place(size_t n, size_t m) { requested_bytes_ = requested_bytes_ - n + m; }
+
+    Stats stats() const
+    {
+        Stats st;
+        st.pages = pages_.size();
+        st.spare_pages = spare_.size();
+        st.reserved_bytes = (pages_.size() + spare_.size()) * page_bytes_ + large_bytes_;
+        st.chunk_bytes = chunk_bytes_ + large_bytes_;
+        st.requested_bytes = requested_bytes_;
+        st.large_allocs = large_allocs_;
+        st.large_bytes = large_bytes_;
+        for (const Class &c : classes_)
+        {
+            if (c.pages == 0)
+                continue;
+            ClassStats cs;
+            cs.chunk_size = c.chunk_size;
+            cs.pages = c.pages;
+            cs.chunks_used = c.live;
+            cs.chunks_free = c.pages * c.per_page - c.live;
+            st.classes.push_back(cs);
+        }
+        return st;
+    }
+
+private:
+    static constexpr size_t kMinChunk = 32;
+    static constexpr size_t kMaxSparePages = 2;
+    static constexpr size_t kLarge = SIZE_MAX;
+
+    struct Page
+    {
+        Page *prev = nullptr; // neighbours in the class's partial list
+        Page *next = nullptr;
+        void *free_list = nullptr; // returned chunks, linked through their first word
+        uint32_t carved = 0;       // chunks handed out from the untouched tail so far
+        uint32_t live = 0;
+        uint16_t cls = 0;
+        size_t slot = 0; // position in pages_
+    };
+
+    static constexpr size_t round8(size_t n) { return (n + 7) & ~size_t(7); }
+    static constexpr size_t kHeaderBytes = (sizeof(Page) + 7) & ~size_t(7);
+
+    struct Class
+    {
+        size_t chunk_size;
+        size_t per_page;
+        Page *partial = nullptr; // pages with at least one free chunk
+        size_t pages = 0;
+        size_t live = 0;
+    };
+
+    size_t class_of(size_t n) const
+    {
+        if (n > classes_.back().chunk_size)
+            return kLarge;
+        auto it = std::lower_bound(classes_.begin(), classes_.end(), n,
+                                   [](const Class &c, size_t size)
+                                   { return c.chunk_size < size; });
+        return static_cast<size_t>(it - classes_.begin());
+    }
+
+    Page *page_of(void *p) const
+    {
+        return reinterpret_cast<Page *>(reinterpret_cast<uintptr_t>(p) & ~(uintptr_t(page_bytes_) - 1));
+    }
+
+    Page *new_page(uint16_t cls)
+    {
+        void *mem;
+        if (!spare_.empty())
+        {
+            mem = spare_.back();
+            spare_.pop_back();
+        }
+        else
+        {
+            mem = ::operator new(page_bytes_, std::align_val_t(page_bytes_));
+        }
+        Page *page = new (mem) Page();
+        page->cls = cls;
+        page->slot = pages_.size();
+        pages_.push_back(page);
+        classes_[cls].pages++;
+        return page;
+    }
+
+    void retire_page(Class &c, Page *page)
+    {
+        c.pages--;
+        Page *last = pages_.back();
+        last->slot = page->slot;
+        pages_[page->slot] = last;
+        pages_.pop_back();
+        if (spare_.size() < kMaxSparePages)
+            spare_.push_back(page);
+        else
+            release_page(page);
+    }
+
+    void release_page(Page *page)
+    {
+        ::operator delete(static_cast<void *>(page), std::align_val_t(page_bytes_));
+    }
+
+    static void push_partial(Class &c, Page *page)
+    {
+        page->prev = nullptr;
+        page->next = c.partial;
+        if (c.partial)
+            c.partial->prev = page;
+        c.partial = page;
+    }
+
+    static void unlink_partial(Class &c, Page *page)
+    {
+        if (page->prev)
+            page->prev->next = page->next;
+        else
+            c.partial = page->next;
+        if (page->next)
+            page->next->prev = page->prev;
+        page->prev = page->next = nullptr;
+    }
+
+    size_t page_bytes_ = kDefaultPageBytes;
+    std::vector<Class> classes_;
+    std::vector<Page *> pages_; // pages owned by a class
+    std::vector<Page *> spare_; // empty pages kept for reuse
+    size_t chunk_bytes_ = 0;
+    size_t requested_bytes_ = 0;
+    size_t large_allocs_ = 0;
+    size_t large_bytes_ = 0;
+};
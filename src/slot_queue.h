@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// -------------------- Slot queue --------------------
+// A bounded multi-producer multi-consumer FIFO of slot indices, for handing
+// out a fixed set of resources (the connection pool's connections). It is
+// Vyukov's array queue: each cell carries a sequence number that says whose
+// turn it is, so push and try_pop are one CAS on a shared position with no
+// lock and no scan.
+//
+// Each index is in the queue at most once and the capacity is at least the
+// number of slots, so push never finds the queue full. pop() blocks while the
+// queue is empty; only that slow path takes the mutex, and push() touches it
+// only when a popper is waiting.
+class SlotQueue
+{
+public:
+    explicit SlotQueue(size_t slots) : mask_(capacity_for(slots) - 1), cells_(new Cell[mask_ + 1])
+    {
+        for (size_t i = 0; i <= mask_; ++i)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    SlotQueue(const SlotQueue &) = delete;
+    SlotQueue &operator=(const SlotQueue &) = delete;
+
+    void push(uint32_t slot)
+    {
+        Cell *cell;
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                // Full: only if a popper has claimed the cell and not freed
+                // it yet; it is about to
+                std::this_thread::yield();
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+            else
+                pos = tail_.load(std::memory_order_relaxed);
+        }
+        cell->slot = slot;
+        cell->seq.store(pos + 1, std::memory_order_release);
+
+        // Pairs with the fence in pop(): either it sees this slot or we see it waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+            }
+            cv_.notify_one();
+        }
+    }
+
+    bool try_pop(uint32_t &slot)
+    {
+        Cell *cell;
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = head_.load(std::memory_order_relaxed);
+        }
+        slot = cell->slot;
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Blocks until a slot is pushed
+    uint32_t pop()
+    {
+        uint32_t slot;
+        if (try_pop(slot))
+            return slot;
+        std::unique_lock<std::mutex> lk(mutex_);
+        waiters_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!try_pop(slot))
+            cv_.wait(lk);
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return slot;
+    }
+
+    // Slots in the queue; exact only when nobody is pushing or popping
+    size_t size() const
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    // Threads blocked in pop()
+    int waiters() const { return waiters_.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<size_t> seq;
+        uint32_t slot = 0;
+    };
+
+    static size_t capacity_for(size_t slots)
+    {
+        size_t n = 2;
+        while (n < slots)
+            n <<= 1;
+        return n;
+    }
+
+    size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size_t> head_{0}; // next pop
+    alignas(64) std::atomic<size_t> tail_{0}; // next push
+    alignas(64) std::atomic<int> waiters_{0};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Wall-clock milliseconds since the Unix epoch; the unit of every expiry time
+// (the same value is stored in kv_pairs.expires_at).
+inline int64_t unix_now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// -------------------- Hierarchical timing wheel --------------------
+// O(1) scheduling of expiry timers. Four levels of 64 slots each: level 0
+// slots are one tick wide, level 1 slots 64 ticks, level 2 4096 ticks and
+// level 3 262144 ticks (about 7 hours at 100 ms ticks). A timer is placed in
+// the lowest level whose span covers its distance from now, and is moved
+// down a level ("cascaded") when the wheel reaches its slot. Timers further
+// out than the top level are parked in the top level and re-placed when they
+// come round.
+//
+// Timers cannot be cancelled; the payload must let the owner recognise a
+// timer that no longer applies when it fires.
+//
+// Not thread-safe.
+template <typename T>
+class TimerWheel
+{
+public:
+    TimerWheel(int64_t now_ms, int64_t tick_ms)
+        : tick_ms_(tick_ms > 0 ? tick_ms : 1), current_(now_ms / tick_ms_)
+    {
+    }
+
+    size_t size() const { return size_; }
+
+    void schedule(int64_t expires_ms, T payload)
+    {
+        // Round up so a timer never fires early; anything already due fires
+        // on the next tick
+        int64_t tick = (expires_ms + tick_ms_ - 1) / tick_ms_;
+        if (tick <= current_)
+            tick = current_ + 1;
+        place(Timer{tick, std::move(payload)});
+        ++size_;
+    }
+
+    // Move the wheel up to now_ms, calling on_expire(payload) for every timer
+    // that falls due on the way
+    template <typename F>
+    void advance(int64_t now_ms, F &&on_expire)
+    {
+        const int64_t target = now_ms / tick_ms_;
+        while (current_ < target)
+        {
+            ++current_;
+
+            // Entering a new slot on an upper level: redistribute its timers,
+            // highest level first so they can keep falling
+            for (int level = kLevels - 1; level >= 1; --level)
+            {
+                if (current_ % span(level) != 0)
+                    continue;
+                std::vector<Timer> moving;
+                moving.swap(wheel_[level][slot_of(current_, level)]);
+                for (Timer &t : moving)
+                    place(std::move(t));
+            }
+
+            std::vector<Timer> due;
+            due.swap(wheel_[0][slot_of(current_, 0)]);
+            size_ -= due.size();
+            for (Timer &t : due)
+                on_expire(t.payload);
+        }
+    }
+
+private:
+    static constexpr int kLevels = 4;
+    static constexpr int kSlotBits = 6;
+    static constexpr int64_t kSlots = int64_t(1) << kSlotBits;
+
+    struct Timer
+    {
+        int64_t tick;
+        T payload;
+    };
+
+    // Ticks covered by one slot of a level
+    static int64_t span(int level) { return int64_t(1) << (kSlotBits * level); }
+
+    static size_t slot_of(int64_t tick, int level)
+    {
+        return static_cast<size_t>((tick >> (kSlotBits * level)) & (kSlots - 1));
+    }
+
+    void place(Timer t)
+    {
+        int64_t delta = t.tick - current_;
+        if (delta < 0)
+            delta = 0;
+
+        int level = 0;
+        while (level < kLevels - 1 && delta >= span(level + 1))
+            ++level;
+
+        // Beyond the top level's reach: park it in the furthest top-level
+        // slot; it is re-placed from there when the wheel gets that far
+        int64_t slot_tick = t.tick;
+        if (delta >= span(kLevels))
+            slot_tick = current_ + span(kLevels) - 1;
+
+        wheel_[level][slot_of(slot_tick, level)].push_back(std::move(t));
+    }
+
+    int64_t tick_ms_;
+    int64_t current_; // last tick processed
+    size_t size_ = 0;
+    std::vector<Timer> wheel_[kLevels][kSlots];
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <zlib.h>
+
+#include "flat_cache_index.h"
+
+// -------------------- Value encoding --------------------
+// Large values may be stored gzip-compressed, both in kv_pairs.item_value and
+// in the cache. A per-entry flags byte (kv_pairs.item_flags, and the cache
+// entry's flags) says how the stored bytes are encoded. gzip framing is used
+// rather than raw deflate so the stored bytes can go out unchanged as a
+// response body with Content-Encoding: gzip.
+
+constexpr uint8_t kValueGzip = 1;
+
+// A value as stored: its bytes and their encoding
+struct StoredValue
+{
+    FlatCacheIndex::SharedValue data;
+    uint8_t flags = 0;
+
+    bool gzipped() const { return flags & kValueGzip; }
+};
+
+// gzip-compress in into out. Returns false (out unspecified) if zlib fails.
+inline bool gzip_compress(std::string_view in, std::string &out, int level = Z_DEFAULT_COMPRESSION)
+{
+    z_stream zs{};
+    // 15 window bits + 16 = gzip header and trailer
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, static_cast<uLong>(in.size())));
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+// Inflate a gzip member into out. Returns false if in is not valid gzip.
+inline bool gzip_decompress(std::string_view in, std::string &out)
+{
+    z_stream zs{};
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+        return false;
+    // The trailer's last four bytes hold the input size mod 2^32
+    size_t guess = in.size() * 4;
+    if (in.size() >= 18)
+    {
+        const unsigned char *t = reinterpret_cast<const unsigned char *>(in.data() + in.size() - 4);
+        guess = size_t(t[0]) | size_t(t[1]) << 8 | size_t(t[2]) << 16 | size_t(t[3]) << 24;
+    }
+    // deflate cannot do better than about 1032:1, so a damaged trailer
+    // does not get to ask for more
+    guess = std::min(guess, in.size() * 1032);
+    out.resize(guess > 0 ? guess : 64);
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    int rc = Z_OK;
+    while (rc == Z_OK)
+    {
+        if (zs.total_out == out.size())
+            out.resize(out.size() * 2);
+        zs.next_out = reinterpret_cast<Bytef *>(&out[zs.total_out]);
+        zs.avail_out = static_cast<uInt>(out.size() - zs.total_out);
+        rc = inflate(&zs, Z_NO_FLUSH);
+    }
+    out.resize(zs.total_out);
+    inflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+// The plain bytes of value: its own buffer if it is not encoded, otherwise
+// a new inflated one. nullptr if the stored bytes are damaged.
+inline FlatCacheIndex::SharedValue decode_value(const StoredValue &value)
+{
+    if (!value.gzipped())
+        return value.data;
+    std::string plain;
+    if (!gzip_decompress(*value.data, plain))
+        return nullptr;
+    return std::make_shared<const std::string>(std::move(plain));
+}